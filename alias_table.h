@@ -0,0 +1,84 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Walker/Vose alias table for sampling from a discrete distribution in constant time.
+/// Each bucket i holds a threshold prob[i] and an alternative index alias[i],
+/// a sample picks a bucket uniformly and then either i or alias[i].
+class AliasTable
+{
+public:
+    AliasTable() {}
+
+    AliasTable( const std::vector<float> & weights )
+    {
+        build(weights);
+    }
+
+    void build( const std::vector<float> & weights )
+    {
+        int n = weights.size();
+        prob.assign(n, 1.0f);
+        alias.resize(n);
+        for( int i = 0; i < n; i++ )
+            alias[i] = i;
+
+        if( n < 2 )
+            return;
+
+        double sum = 0.0;
+        for( int i = 0; i < n; i++ )
+            sum += std::max(weights[i], 0.0f);
+        if( sum <= 0.0 )
+            return; // uniform
+
+        // scaled probabilities, average is 1
+        std::vector<double> p(n);
+        std::vector<int> small, large;
+        for( int i = 0; i < n; i++ )
+        {
+            p[i] = std::max(weights[i], 0.0f) * n / sum;
+            if( p[i] < 1.0 )
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+
+        while( !small.empty() && !large.empty() )
+        {
+            int s = small.back(); small.pop_back();
+            int l = large.back();
+
+            prob[s] = p[s];
+            alias[s] = l;
+
+            // l gives away what is missing from s
+            p[l] = (p[l] + p[s]) - 1.0;
+            if( p[l] < 1.0 )
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // whatever is left is (up to rounding) full
+        for( int i = 0; i < large.size(); i++ )
+            prob[large[i]] = 1.0f;
+        for( int i = 0; i < small.size(); i++ )
+            prob[small[i]] = 1.0f;
+    }
+
+    /// Sample an index given a uniformly distributed 32 bit random word.
+    /// The high part of r * n selects the bucket, the low part is the uniform value within it.
+    int sample( uint32_t r ) const
+    {
+        uint64_t m = (uint64_t)r * prob.size();
+        int i = (int)(m >> 32);
+        float u = (uint32_t)m * (1.0f / 4294967296.0f);
+        return u < prob[i] ? i : alias[i];
+    }
+
+    int size() const { return prob.size(); }
+
+    std::vector<float> prob;
+    std::vector<int> alias;
+};
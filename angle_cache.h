@@ -0,0 +1,293 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Angle independent form of an interpreted turtle program, used to redraw it quickly
+/// when only the angle offset changes (e.g. while it is adjusted interactively).
+/// Each move of the turtle gives a point, stored with:
+/// - the index of the point it starts from
+/// - its length
+/// - the net number of turns of the heading, and the sum of the angles drawn for them
+///   when the angle is randomized, so its heading is 90 + angle_sum + turns*(delta_offset) degrees
+///   (angle_sum being turns*delta for a fixed angle)
+/// Evaluating the geometry for an angle offset is then a parallel pass computing the displacement
+/// of each point, a pass adding each point to the one it starts from (which comes before it),
+/// and a parallel pass writing the vertex pairs of drawn segments.
+class AngleCache
+{
+public:
+    /// True if the cache holds the given program, interpreted with the same parameters
+    bool matches( const TurtleProgram & program, const FloatParam & delta, float d, bool merge_segments ) const
+    {
+        return valid && revision == program.revision && delta_values == delta.values && delta_seed == delta.seed
+            && this->d == d && this->merge_segments == merge_segments;
+    }
+
+    /// Interprets a program into the cache, returns false if the program can't be cached
+    /// (extension symbols, more than max_points moves, or more than max_bytes), in which case its storage is freed
+    bool build( const TurtleProgram & program, const FloatParam & delta, float d, bool merge_segments,
+                double max_bytes = HUGE_VAL )
+    {
+        valid = false;
+        if( !program.extensions.empty() )
+            return false;
+        size_t limit = std::min((double)max_points, max_bytes/POINT_BYTES);
+
+        revision = program.revision;
+        delta_values = delta.values;
+        delta_seed = delta.seed;
+        fixed = delta.values.size() < 2;
+        this->d = d;
+        this->merge_segments = merge_segments;
+
+        points.clear();
+        drawn.clear();
+
+        struct State
+        {
+            uint32_t point;
+            int turns;
+            float angle_sum;
+        };
+
+        // the origin
+        Point origin = { 0, 0, 0.0f, 0.0f };
+        points.push_back(origin);
+
+        std::vector<State> stack;
+        State s = { 0, 0, 0.0f };
+        uint64_t draws = 0;
+        min_turns = max_turns = 0;
+
+        const std::vector<uint8_t> & code = program.code;
+        for( size_t i = 0; i < code.size(); i++ )
+        {
+            int op = TurtleProgram::opcode(code[i]);
+            int n = TurtleProgram::count(code[i]);
+            switch( op )
+            {
+                case TurtleProgram::OP_PUSH:
+                    for( int j = 0; j < n; j++ )
+                        stack.push_back(s);
+                    continue;
+                case TurtleProgram::OP_POP:
+                    for( int j = 0; j < n && !stack.empty(); j++ )
+                    {
+                        s = stack.back();
+                        stack.pop_back();
+                    }
+                    continue;
+                default:
+                    break;
+            }
+
+            // runs are merged as in TurtleProgram::run
+            while( i+1 < code.size() && TurtleProgram::opcode(code[i+1]) == op )
+                n += TurtleProgram::count(code[++i]);
+
+            switch( op )
+            {
+                case TurtleProgram::OP_F:
+                case TurtleProgram::OP_f:
+                {
+                    bool draw = op == TurtleProgram::OP_F;
+                    int segments = (draw && !merge_segments) ? n : 1;
+                    float l = segments > 1 ? d : d*n;
+                    for( int j = 0; j < segments; j++ )
+                    {
+                        if( points.size() >= limit )
+                        {
+                            clear();
+                            return false;
+                        }
+                        Point p = { s.point, s.turns, s.angle_sum, l };
+                        s.point = points.size();
+                        points.push_back(p);
+                        if( draw )
+                            drawn.push_back(s.point);
+                    }
+                    break;
+                }
+                case TurtleProgram::OP_PLUS:
+                case TurtleProgram::OP_MINUS:
+                {
+                    int sign = op == TurtleProgram::OP_PLUS ? 1 : -1;
+                    s.turns += sign*n;
+                    // each turn draws an angle, in the same order as the turtle does
+                    if( !fixed )
+                        for( int j = 0; j < n; j++ )
+                            s.angle_sum += sign*delta.at(draws++);
+                    min_turns = std::min(min_turns, s.turns);
+                    max_turns = std::max(max_turns, s.turns);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        x.resize(points.size());
+        y.resize(points.size());
+        valid = true;
+        return true;
+    }
+
+    /// Frees the storage of the cache
+    void clear()
+    {
+        valid = false;
+        std::vector<Point>().swap(points);
+        std::vector<uint32_t>().swap(drawn);
+        std::vector<float>().swap(x);
+        std::vector<float>().swap(y);
+    }
+
+    /// Bytes the cache takes for a program of n moves, at most
+    static double bytes( double moves ) { return (moves + 1)*POINT_BYTES; }
+
+    /// Number of vertices written by evaluate()
+    size_t vertices() const { return 2*drawn.size(); }
+
+    /// Computes the geometry for an angle offset, writing the vertices of drawn segments to out,
+    /// and their bounds to bounds
+    void evaluate( float delta_offset, vec3p * out, ThreadPool * pool )
+    {
+        bounds.clear();
+        size_t n = points.size();
+
+        // with a fixed angle there is one direction per net number of turns
+        if( fixed )
+        {
+            double angle = Turtle2d::snap_angle((delta_values.size() ? delta_values[0] : 0.0f) + delta_offset);
+            size_t n_directions = max_turns - min_turns + 1;
+            directions.resize(n_directions);
+            // the heading of curves like Koch's keeps turning the same way, so there can be
+            // as many directions as points: blocks of them are computed by rotation from an exact value
+            double ca = cos(radians(angle)), sa = sin(radians(angle));
+            for_each_range(pool, (n_directions + DIRECTION_BLOCK - 1)/DIRECTION_BLOCK, [&]( size_t begin, size_t end ) {
+                for( size_t b = begin; b < end; b++ )
+                {
+                    size_t k = b*DIRECTION_BLOCK;
+                    double a = radians(90.0 + (min_turns + (double)k)*angle);
+                    double c = cos(a), s = sin(a);
+                    for( ; k < std::min(n_directions, (b+1)*DIRECTION_BLOCK); k++ )
+                    {
+                        directions[k] = std::make_pair((float)c, (float)s);
+                        double t = c*ca - s*sa;
+                        s = c*sa + s*ca;
+                        c = t;
+                    }
+                }
+            });
+        }
+
+        for_each_range(pool, n, [&]( size_t begin, size_t end ) {
+            for( size_t i = begin; i < end; i++ )
+            {
+                const Point & p = points[i];
+                float dx, dy;
+                if( fixed )
+                {
+                    const std::pair<float, float> & dir = directions[p.turns - min_turns];
+                    dx = dir.first;
+                    dy = dir.second;
+                }
+                else
+                {
+                    double a = radians(90.0 + p.angle_sum + p.turns*(double)delta_offset);
+                    dx = cos(a);
+                    dy = sin(a);
+                }
+                x[i] = dx*p.length;
+                y[i] = dy*p.length;
+            }
+        });
+
+        // points come after the point they start from
+        for( size_t i = 1; i < n; i++ )
+        {
+            x[i] += x[points[i].parent];
+            y[i] += y[points[i].parent];
+        }
+
+        for_each_range(pool, drawn.size(), [&]( size_t begin, size_t end ) {
+            for( size_t j = begin; j < end; j++ )
+            {
+                uint32_t i = drawn[j];
+                uint32_t parent = points[i].parent;
+                out[2*j] = vec3(x[parent], y[parent], 0);
+                out[2*j+1] = vec3(x[i], y[i], 0);
+            }
+            
+            // bounds of each range, merged as ranges complete
+            Bounds b;
+            b.add(out + 2*begin, 2*(end - begin));
+            std::lock_guard<std::mutex> lock(bounds_mutex);
+            bounds.add(b);
+        });
+    }
+
+    /// Approximate memory used by the cache in bytes
+    size_t memory() const
+    {
+        return points.size()*(sizeof(Point) + 2*sizeof(float)) + drawn.size()*sizeof(uint32_t);
+    }
+
+    /// Bounds of the vertices written by evaluate()
+    Bounds bounds;
+    
+    /// Programs with more moves are not cached
+    size_t max_points = 1<<24;
+    size_t min_chunk_size = 1<<14;
+
+private:
+    struct Point
+    {
+        uint32_t parent;
+        int turns;
+        float angle_sum;
+        float length;
+    };
+
+    enum
+    {
+        DIRECTION_BLOCK = 256,
+        // a point, its position during evaluation, and its index if drawn
+        POINT_BYTES = sizeof(Point) + 2*sizeof(float) + sizeof(uint32_t)
+    };
+
+    static double radians( double deg ) { return deg*(3.14159265358979323846/180.0); }
+
+    /// Calls fn on ranges covering [0, n), in parallel if a pool is given
+    void for_each_range( ThreadPool * pool, size_t n, const std::function<void(size_t, size_t)> & fn )
+    {
+        int n_chunks = 1;
+        if( pool && pool->size() > 1 )
+            n_chunks = std::max((size_t)1, std::min((size_t)pool->size()*4, n/min_chunk_size));
+        if( n_chunks == 1 )
+        {
+            fn(0, n);
+            return;
+        }
+        pool->parallel_for(n_chunks, [&]( int c ) {
+            fn(c*n/n_chunks, (c+1)*n/n_chunks);
+        });
+    }
+
+    bool valid = false;
+    unsigned revision = 0;
+    std::vector<float> delta_values;
+    uint64_t delta_seed = 0;
+    bool fixed = true;
+    float d = 1;
+    bool merge_segments = true;
+
+    std::vector<Point> points;
+    // drawn points, in the order of their segments
+    std::vector<uint32_t> drawn;
+    int min_turns = 0, max_turns = 0;
+
+    // positions, displacements during evaluation
+    std::vector<float> x, y;
+    std::vector< std::pair<float, float> > directions;
+    std::mutex bounds_mutex;
+};
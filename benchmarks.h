@@ -0,0 +1,268 @@
+#pragma once
+#include <chrono>
+
+///////////////////////////////////////////////////////
+/// Micro-benchmarks, run from the app with the M key.
+/// Results are printed to the console.
+
+/// Wall clock seconds taken by fn
+double bench_seconds( const std::function<void()> & fn )
+{
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    fn();
+    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t1-t0).count();
+}
+
+/// Linear scan over weights vs. alias table sampling of successors
+void benchmark_weighted_sampling()
+{
+    const int n_samples = 1<<22;
+    const int sizes[] = { 3, 8, 32, 128 };
+
+    // random numbers are generated beforehand so only sampling is timed
+    std::vector<uint32_t> R(n_samples);
+    std::vector<float> U(n_samples);
+    for( int i = 0; i < n_samples; i++ )
+    {
+        R[i] = counter_rng(0, 0, 0, i);
+        U[i] = (R[i] >> 8) * (1.0f / 16777216.0f);
+    }
+
+    printf("Weighted sampling, %d samples\n", n_samples);
+    for( int k = 0; k < 4; k++ )
+    {
+        std::vector<float> W;
+        for( int i = 0; i < sizes[k]; i++ )
+            W.push_back(1.0 + (counter_rng(1, 0, 0, i) % 100));
+        AliasTable table(W);
+
+        long sum_linear = 0;
+        double t_linear = bench_seconds([&]() {
+            for( int i = 0; i < n_samples; i++ )
+                sum_linear += weighted_sample_index(W, U[i]);
+        });
+
+        long sum_alias = 0;
+        double t_alias = bench_seconds([&]() {
+            for( int i = 0; i < n_samples; i++ )
+                sum_alias += table.sample(R[i]);
+        });
+
+        // mean index should agree for both methods
+        printf("  %3d weights: linear %6.2f ns/sample, alias %6.2f ns/sample (mean index %.3f vs %.3f)\n",
+               sizes[k],
+               t_linear*1e9/n_samples, t_alias*1e9/n_samples,
+               (double)sum_linear/n_samples, (double)sum_alias/n_samples);
+    }
+}
+
+/// Turtle interpretation with 4x4 matrices vs. the planar turtle, without any mesh output
+void benchmark_turtle()
+{
+    const int n_commands = 1<<22;
+
+    // random walk with branches, at most 32 levels deep
+    std::vector<char> C(n_commands);
+    int depth = 0;
+    for( int i = 0; i < n_commands; i++ )
+    {
+        const char cmds[] = "FFF+-[]";
+        char c = cmds[counter_rng(2, 0, 0, i) % 7];
+        if( (c == '[' && depth == 32) || (c == ']' && depth == 0) )
+            c = 'F';
+        depth += (c == '[') - (c == ']');
+        C[i] = c;
+    }
+
+    FloatParam delta = 25.7;
+
+    vec3 sum_mat(0, 0, 0);
+    double t_mat = bench_seconds([&]() {
+        std::vector<mat4t> stack(1, mat4t());
+        for( int i = 0; i < n_commands; i++ )
+        {
+            switch( C[i] )
+            {
+                case 'F':
+                    stack.back() = mat4t().translate(0, 1, 0) * stack.back();
+                    sum_mat += (vec4(0,0,0,1)*stack.back()).xyz();
+                    break;
+                case '+': stack.back() = mat4t().rotateZ(delta) * stack.back(); break;
+                case '-': stack.back() = mat4t().rotateZ(-delta) * stack.back(); break;
+                case '[': stack.push_back(stack.back()); break;
+                case ']': stack.pop_back(); break;
+            }
+        }
+    });
+
+    vec3 sum_turtle(0, 0, 0);
+    double t_turtle = bench_seconds([&]() {
+        Turtle2d turtle;
+        turtle.begin(delta, 0);
+        for( int i = 0; i < n_commands; i++ )
+        {
+            switch( C[i] )
+            {
+                case 'F':
+                    turtle.move(1);
+                    sum_turtle += turtle.pos();
+                    break;
+                case '+': turtle.rotate(1); break;
+                case '-': turtle.rotate(-1); break;
+                case '[': turtle.push(); break;
+                case ']': turtle.pop(); break;
+            }
+        }
+    });
+
+    printf("Turtle, %d commands: matrix %6.2f ns/command, planar %6.2f ns/command (mean position %g %g vs %g %g)\n",
+           n_commands,
+           t_mat*1e9/n_commands, t_turtle*1e9/n_commands,
+           sum_mat.x()/n_commands, sum_mat.y()/n_commands, sum_turtle.x()/n_commands, sum_turtle.y()/n_commands);
+}
+
+/// Renderer only moving a turtle, Base is LsystemRenderer or a BatchRenderer
+template <class Base>
+class BenchTurtleRenderer : public Base
+{
+public:
+    void begin() { turtle.begin(this->delta, 0); }
+    void F() { turtle.move(1); sum += turtle.pos(); }
+    void f() { turtle.move(1); }
+    void plus() { turtle.rotate(1); }
+    void minus() { turtle.rotate(-1); }
+    void push() { turtle.push(); }
+    void pop() { turtle.pop(); }
+    void F_run( int n ) { turtle.move(n); sum += turtle.pos(); }
+    void f_run( int n ) { turtle.move(n); }
+    void rotate( int n ) { turtle.rotate(n); }
+    
+    Turtle2d turtle;
+    vec3 sum = vec3(0, 0, 0);
+};
+
+class VirtualBenchRenderer : public BenchTurtleRenderer<LsystemRenderer> {};
+class InlineBenchRenderer final : public BenchTurtleRenderer< BatchRenderer<InlineBenchRenderer> > {};
+
+/// Dispatch of turtle commands to a renderer: one virtual call per symbol, batches through
+/// the virtual interface, and batches dispatched statically to the final renderer type
+void benchmark_dispatch()
+{
+    const int n_symbols = 1<<22;
+
+    // branching random walk with unmerged runs
+    std::string str(n_symbols, 'F');
+    int depth = 0;
+    for( int i = 0; i < n_symbols; i++ )
+    {
+        const char cmds[] = "FF+-[]f";
+        char c = cmds[counter_rng(3, 0, 0, i) % 7];
+        if( (c == '[' && depth == 32) || (c == ']' && depth == 0) )
+            c = 'F';
+        depth += (c == '[') - (c == ']');
+        str[i] = c;
+    }
+
+    TurtleProgram program;
+    program.set_alphabet(TurtleProgram::builtin_alphabet());
+    program.compile(str.c_str(), str.length());
+
+    VirtualBenchRenderer symbol_renderer, virtual_renderer;
+    InlineBenchRenderer inline_renderer;
+    LsystemRenderer * r = &symbol_renderer;
+    LsystemRenderer * rv = &virtual_renderer;
+    symbol_renderer.delta = virtual_renderer.delta = inline_renderer.delta = 25.7;
+
+    double t_symbol = bench_seconds([&]() {
+        r->begin();
+        for( int i = 0; i < n_symbols; i++ )
+            program.execute_symbol(str[i], r);
+    });
+    double t_virtual = bench_seconds([&]() {
+        rv->begin();
+        program.run(rv);
+    });
+    double t_inline = bench_seconds([&]() {
+        inline_renderer.begin();
+        program.run(&inline_renderer);
+    });
+
+    printf("Dispatch, %d symbols: per symbol %6.2f ns/symbol, virtual batches %6.2f ns/symbol, static batches %6.2f ns/symbol (checksum %g vs %g)\n",
+           n_symbols,
+           t_symbol*1e9/n_symbols, t_virtual*1e9/n_symbols, t_inline*1e9/n_symbols,
+           virtual_renderer.sum.x(), inline_renderer.sum.x());
+}
+
+/// Spring integration of paths one at a time with spring_path vs. batches of SpringBatch::LANES paths
+void benchmark_springs()
+{
+    const int n_paths = 1024;
+    const float kp = 190, kv = 0.19f * 2.0f * sqrtf(kp), dt = 0.005f, speed = 3.5f, t_mul = 1.9f;
+
+    // random walks of 2 to 64 unit segments
+    std::vector<polyline> P(n_paths);
+    for( int i = 0; i < n_paths; i++ )
+    {
+        int n_segments = 2 + counter_rng(3, 0, i, 0) % 63;
+        vec3 p(0, 0, 0);
+        float a = 90;
+        P[i].push_back(p);
+        for( int j = 0; j < n_segments; j++ )
+        {
+            a += counter_uniform(3, 1, i, j)*50 - 25;
+            p += vec3(cosf(a*(3.14159265f/180)), sinf(a*(3.14159265f/180)), 0);
+            P[i].push_back(p);
+        }
+    }
+    // batched by similar durations, as SpringRenderer does
+    std::stable_sort(P.begin(), P.end(), []( const polyline & a, const polyline & b ) { return a.size() < b.size(); });
+
+    SpringRenderer renderer(0);
+    std::vector<polyline> scalar(n_paths), batched(n_paths);
+    double t_scalar = bench_seconds([&]() {
+        for( int i = 0; i < n_paths; i++ )
+            scalar[i] = renderer.spring_path(P[i], speed, kp, kv, dt, t_mul);
+    });
+
+    double t_batch = bench_seconds([&]() {
+        const int lanes = SpringBatch::LANES;
+        SpringBatch batch;
+        for( int b = 0; b < n_paths; b += lanes )
+        {
+            const polyline * in[lanes];
+            polyline * out[lanes];
+            float t_end[lanes], duration[lanes];
+            for( int j = 0; j < lanes; j++ )
+            {
+                in[j] = &P[b+j];
+                out[j] = &batched[b+j];
+                t_end[j] = renderer.path_time(P[b+j], speed);
+                duration[j] = t_end[j]*t_mul;
+            }
+            batch.integrate(in, t_end, duration, lanes, kp, kv, dt, out);
+        }
+    });
+
+    size_t steps = 0;
+    int same = 0;
+    for( int i = 0; i < n_paths; i++ )
+    {
+        steps += scalar[i].size();
+        same += scalar[i].size() == batched[i].size()
+                && std::equal(scalar[i].begin(), scalar[i].end(), batched[i].begin(), []( const vec3 & a, const vec3 & b ) {
+                       return a.x() == b.x() && a.y() == b.y();
+                   });
+    }
+
+    printf("Springs, %d paths, %d steps: scalar %6.2f Msteps/s, batches of %d %6.2f Msteps/s (%d of %d paths identical)\n",
+           n_paths, (int)steps, steps/t_scalar*1e-6, (int)SpringBatch::LANES, steps/t_batch*1e-6, same, n_paths);
+}
+
+void run_benchmarks()
+{
+    benchmark_weighted_sampling();
+    benchmark_turtle();
+    benchmark_dispatch();
+    benchmark_springs();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cfloat>
+
+///////////////////////////////////////////////////////
+/// Running minimum and maximum of a set of points, empty until a point is added.
+/// Bounds of separately computed parts (e.g. on different threads) are merged with add(Bounds).
+struct Bounds
+{
+    Bounds()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for( int i = 0; i < 3; i++ )
+        {
+            lo[i] = FLT_MAX;
+            hi[i] = -FLT_MAX;
+        }
+    }
+
+    bool empty() const { return lo[0] > hi[0]; }
+
+    void add( const vec3p & p )
+    {
+        add(p.x(), p.y(), p.z());
+    }
+
+    void add( float x, float y, float z )
+    {
+        lo[0] = std::min(lo[0], x); hi[0] = std::max(hi[0], x);
+        lo[1] = std::min(lo[1], y); hi[1] = std::max(hi[1], y);
+        lo[2] = std::min(lo[2], z); hi[2] = std::max(hi[2], z);
+    }
+
+    void add( const Bounds & b )
+    {
+        for( int i = 0; i < 3; i++ )
+        {
+            lo[i] = std::min(lo[i], b.lo[i]);
+            hi[i] = std::max(hi[i], b.hi[i]);
+        }
+    }
+
+    /// Adds n points. Four points are 12 consecutive floats, reduced lane by lane
+    /// (each lane always holds the same coordinate), so the loop is vectorized.
+    void add( const vec3p * p, size_t n )
+    {
+        const float * f = (const float*)p;
+        size_t n4 = n & ~(size_t)3;
+        if( n4 )
+        {
+            float l[12], h[12];
+            for( int j = 0; j < 12; j++ )
+                l[j] = h[j] = f[j];
+            for( size_t i = 0; i < n4*3; i += 12 )
+            {
+                for( int j = 0; j < 12; j++ )
+                {
+                    l[j] = l[j] < f[i+j] ? l[j] : f[i+j];
+                    h[j] = h[j] > f[i+j] ? h[j] : f[i+j];
+                }
+            }
+            for( int j = 0; j < 12; j++ )
+            {
+                lo[j%3] = std::min(lo[j%3], l[j]);
+                hi[j%3] = std::max(hi[j%3], h[j]);
+            }
+        }
+        for( size_t i = n4; i < n; i++ )
+            add(p[i]);
+    }
+
+    /// True if the boxes overlap, never for an empty box
+    bool intersects( const Bounds & b ) const
+    {
+        for( int i = 0; i < 3; i++ )
+        {
+            if( lo[i] > b.hi[i] || hi[i] < b.lo[i] )
+                return false;
+        }
+        return !empty() && !b.empty();
+    }
+
+    vec3 min() const { return empty() ? vec3(0, 0, 0) : vec3(lo[0], lo[1], lo[2]); }
+    vec3 max() const { return empty() ? vec3(0, 0, 0) : vec3(hi[0], hi[1], hi[2]); }
+
+    aabb get_aabb() const
+    {
+        return aabb((min() + max())*0.5f, (max() - min())*0.5f);
+    }
+
+    float lo[3], hi[3];
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "bounds.h"
+#include "turtle_2d.h"
+
+///////////////////////////////////////////////////////
+/// Bounding volume hierarchy over the branches of a turtle program, used to draw only what is in view.
+/// Each push instruction opens a branch, which ends where the stack gets back to its depth before the push.
+/// Branches nest like the brackets, and a branch's box contains the segments drawn in it and in
+/// the branches it contains. The turtle is in the same state after a branch as before it, so a branch
+/// out of view can be skipped whole, with all the branches in it, and the rest is drawn unchanged.
+/// Boxes are in world coordinates, so they are only valid for a fixed angle and step length.
+class BranchBounds
+{
+public:
+    /// True if build() was called for the given program and parameters, whether it succeeded or not (see usable()),
+    /// so a program that can't be culled is only interpreted once
+    bool matches( const TurtleProgram & program, const FloatParam & delta, float delta_offset, float d ) const
+    {
+        return built && revision == program.revision && delta_values == delta.values
+            && this->delta_offset == delta_offset && this->d == d;
+    }
+
+    /// True if the last build() succeeded
+    bool usable() const { return valid; }
+
+    /// Interprets a program with a turtle at its initial state, recording the box of each branch.
+    /// Returns false if the program can't be culled (extension symbols, randomized angles, or a stack underflow),
+    /// in which case the storage of the hierarchy is freed and the failure kept until the parameters change
+    bool build( const TurtleProgram & program, const Turtle2d & turtle, const FloatParam & delta, float delta_offset, float d )
+    {
+        valid = false;
+        built = true;
+        revision = program.revision;
+        delta_values = delta.values;
+        this->delta_offset = delta_offset;
+        this->d = d;
+
+        if( !program.extensions.empty() || turtle.randomized() )
+        {
+            release();
+            return false;
+        }
+
+        branches.clear();
+        bounds.clear();
+
+        Turtle2d t = turtle;
+        // branches not closed yet, innermost last
+        std::vector<uint32_t> open;
+        const std::vector<uint8_t> & code = program.code;
+        for( size_t i = 0; i < code.size(); i++ )
+        {
+            uint8_t ins = code[i];
+            int n = TurtleProgram::count(ins);
+            switch( TurtleProgram::opcode(ins) )
+            {
+                case TurtleProgram::OP_F:
+                {
+                    Bounds & b = open.empty() ? bounds : branches[open.back()].bounds;
+                    b.add(t.pos());
+                    t.move(d*n);
+                    b.add(t.pos());
+                    break;
+                }
+                case TurtleProgram::OP_f:
+                    t.move(d*n);
+                    break;
+                case TurtleProgram::OP_PLUS:
+                    t.rotate(n);
+                    break;
+                case TurtleProgram::OP_MINUS:
+                    t.rotate(-n);
+                    break;
+                case TurtleProgram::OP_PUSH:
+                {
+                    Branch br;
+                    br.depth = t.stack.size();
+                    open.push_back(branches.size());
+                    branches.push_back(br);
+                    for( int j = 0; j < n; j++ )
+                        t.push();
+                    break;
+                }
+                case TurtleProgram::OP_POP:
+                    for( int j = 0; j < n; j++ )
+                    {
+                        if( !t.pop() )
+                        {
+                            release();
+                            return false;
+                        }
+                        if( !open.empty() && t.stack.size() == branches[open.back()].depth )
+                            close(open, i, n - (j+1));
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // unbalanced brackets run to the end of the program
+        while( !open.empty() )
+            close(open, code.size(), 0);
+
+        valid = true;
+        return true;
+    }
+
+    /// Executes the program with a renderer, skipping the branches with a box outside view.
+    /// Returns the number of branches skipped.
+    template <class Renderer>
+    size_t run( const TurtleProgram & program, Renderer * renderer, const Bounds & view ) const
+    {
+        TurtleProgram::Batch<Renderer> batch(program, renderer);
+        size_t skipped = 0;
+        uint32_t next = 0;
+        const std::vector<uint8_t> & code = program.code;
+        for( size_t i = 0; i < code.size(); i++ )
+        {
+            uint8_t ins = code[i];
+            if( TurtleProgram::opcode(ins) == TurtleProgram::OP_PUSH )
+            {
+                const Branch & br = branches[next];
+                if( !br.bounds.intersects(view) )
+                {
+                    // continue after the pop closing the branch, with the pops left in that instruction
+                    skipped++;
+                    next = br.next;
+                    i = br.end;
+                    if( br.rest )
+                        batch.add(TurtleProgram::instruction(TurtleProgram::OP_POP, br.rest - 1));
+                    continue;
+                }
+                next++;
+            }
+            batch.add(ins);
+        }
+        batch.flush();
+        return skipped;
+    }
+
+    bool empty() const { return branches.empty(); }
+
+    /// Frees the storage of the hierarchy, it has to be built again
+    void clear()
+    {
+        release();
+        built = false;
+    }
+
+    /// Approximate memory used by the hierarchy in bytes
+    size_t memory() const { return branches.size()*sizeof(Branch); }
+
+    /// Bytes the hierarchy takes for a program with n pushes
+    static double bytes( double pushes ) { return pushes*sizeof(Branch); }
+
+    /// Bounds of everything the program draws
+    Bounds bounds;
+
+private:
+    struct Branch
+    {
+        Bounds bounds;
+        uint32_t end;       // pop instruction closing it
+        uint32_t rest;      // pops of that instruction after the one closing the branch
+        uint32_t next;      // first branch after this one and the branches it contains
+        uint32_t depth;     // stack size before the push
+    };
+
+    void release()
+    {
+        valid = false;
+        std::vector<Branch>().swap(branches);
+    }
+
+    void close( std::vector<uint32_t> & open, size_t end, int rest )
+    {
+        Branch & br = branches[open.back()];
+        br.end = end;
+        br.rest = rest;
+        br.next = branches.size();
+        open.pop_back();
+        Bounds & parent = open.empty() ? bounds : branches[open.back()].bounds;
+        parent.add(br.bounds);
+    }
+
+    std::vector<Branch> branches;
+
+    bool valid = false;
+    bool built = false;
+    unsigned revision = 0;
+    std::vector<float> delta_values;
+    float delta_offset = 0;
+    float d = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+///////////////////////////////////////////////////////
+/// Schedule of an upload of n items split into fixed size chunks, sent a few per frame
+/// within a time budget, so a large mesh doesn't block a frame.
+/// Items [0, done()) have been sent, so they can be drawn while the rest is on its way.
+/// The upload itself is a function of the range of a chunk and the clock can be replaced,
+/// so the schedule doesn't depend on GL.
+class ChunkedUpload
+{
+public:
+    typedef std::function<void(size_t first, size_t n)> Sender;
+    typedef std::function<double()> Clock;
+
+    ChunkedUpload()
+    {
+        clock = []() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        };
+    }
+
+    /// Starts an upload of n items, replacing any upload in progress
+    void begin( size_t n )
+    {
+        total = n;
+        sent = 0;
+    }
+
+    /// Sends chunks until the budget in seconds is spent, at least one per call so the upload always progresses.
+    /// A budget <= 0 sends everything. Returns true once all items have been sent.
+    bool step( double budget, const Sender & send )
+    {
+        double start = clock();
+        while( sent < total )
+        {
+            size_t n = std::min(chunk_size, total - sent);
+            send(sent, n);
+            sent += n;
+            if( budget > 0 && clock() - start >= budget )
+                break;
+        }
+        return finished();
+    }
+
+    bool finished() const { return sent == total; }
+    size_t done() const { return sent; }
+    size_t size() const { return total; }
+
+    size_t chunk_size = 1<<16;
+    Clock clock;
+
+private:
+    size_t total = 0;
+    size_t sent = 0;
+};
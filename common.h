@@ -50,26 +50,32 @@ std::vector<std::string> files_in_directory( const std::string& path )
 }
 
 // Utils:
-/// Weighted random sample between a number of elements in an array
-template <class T>
-T weighted_sample( const std::vector<T>& X, const std::vector<float> &W )
+/// Weighted sample of an index into an array of weights, given a uniform random number u in [0,1)
+int weighted_sample_index( const std::vector<float> &W, float u )
 {
     float cum = 0.0;
     for( int i = 0; i < W.size(); i++ )
         cum += W[i];
     
-    float sample = drand48()*cum;
+    float sample = u*cum;
     
-    for( int i = 0; i < X.size(); i++ )
+    for( int i = 0; i < W.size(); i++ )
     {
         cum -= W[i];
         if( cum < sample )
-            return X[i];
+            return i;
     }
     
     // we should not be here :/
     assert(0);
-    return X[0];
+    return 0;
+}
+
+/// Weighted sample between a number of elements in an array, given a uniform random number u in [0,1)
+template <class T>
+T weighted_sample( const std::vector<T>& X, const std::vector<float> &W, float u )
+{
+    return X[weighted_sample_index(W, u)];
 }
 
 /// Python-like check if key is in dictionary
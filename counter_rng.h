@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+///////////////////////////////////////////////////////
+/// Counter based random numbers (Philox4x32-10, Salmon et al. 2011).
+/// Each random number is a pure function of a counter and a key,
+/// so any element of a random sequence can be computed independently of the others,
+/// in any order and on any thread.
+
+struct Philox4x32
+{
+    uint32_t v[4];
+
+    Philox4x32( uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1 )
+    {
+        v[0] = c0; v[1] = c1; v[2] = c2; v[3] = c3;
+        for( int i = 0; i < 10; i++ )
+        {
+            round(k0, k1);
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+    }
+
+    void round( uint32_t k0, uint32_t k1 )
+    {
+        uint64_t p0 = (uint64_t)0xD2511F53 * v[0];
+        uint64_t p1 = (uint64_t)0xCD9E8D57 * v[2];
+        uint32_t c1 = v[1], c3 = v[3];
+        v[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        v[1] = (uint32_t)p1;
+        v[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        v[3] = (uint32_t)p0;
+    }
+};
+
+/// Independent random streams sharing a seed
+enum
+{
+    RNG_STREAM_PRODUCTION = 0, // successor choices, keyed on (generation, symbol index)
+    RNG_STREAM_PARAM = 1,      // FloatParam values, keyed on draw index
+    RNG_STREAM_TRUNK = 2       // trunk jitter of spring paths, keyed on path index
+};
+
+/// Random 32 bit word for a given seed, stream, sub-stream (e.g. generation) and index
+inline uint32_t counter_rng( uint64_t seed, uint32_t stream, uint32_t sub, uint64_t index )
+{
+    Philox4x32 r((uint32_t)index, (uint32_t)(index >> 32), sub, stream,
+                 (uint32_t)seed, (uint32_t)(seed >> 32));
+    return r.v[0];
+}
+
+/// Uniform random number in [0, 1) for a given seed, stream, sub-stream and index
+inline float counter_uniform( uint64_t seed, uint32_t stream, uint32_t sub, uint64_t index )
+{
+    return (counter_rng(seed, stream, sub, index) >> 8) * (1.0f / 16777216.0f);
+}
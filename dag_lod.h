@@ -0,0 +1,261 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Screen space level of detail over a derivation DAG, with a fixed angle.
+/// The expansion of each node is summarized, bottom up, as the state it leads to from a turtle
+/// at the origin heading up (a rigid transform of the plane) and the radius of a disc around its start
+/// containing everything it draws. A node smaller than a given size is then drawn as a single segment
+/// to its end state instead of being expanded, so the cost of a traversal follows what is visible
+/// rather than the length of the derivation. Shared nodes are summarized once.
+/// Nodes with extension symbols or brackets that don't balance within them are always expanded.
+class DagLod
+{
+public:
+    struct Summary
+    {
+        float x, y;     // end position
+        int turns;      // net number of turns
+        float radius;   // distance from the start containing all points
+        bool draws;
+        bool collapsible;
+    };
+
+    /// Summarizes the nodes of a DAG, for the instructions of a program's symbols and an angle in degrees
+    void compute( const DerivationDag & dag, const TurtleProgram & program, double angle )
+    {
+        this->angle = angle;
+        summaries.resize(dag.nodes.size());
+        // children always have lower ids than their parents
+        for( uint32_t i = 0; i < dag.nodes.size(); i++ )
+            summaries[i] = summarize(dag, program, i);
+    }
+
+    void clear() { summaries.clear(); }
+    bool empty() const { return summaries.empty(); }
+
+    /// Angle the summaries were computed for
+    double get_angle() const { return angle; }
+
+    /// Calls symbol(a) for each symbol of the derivation in order, except in nodes with a radius below size,
+    /// for which shortcut(summary) is called instead
+    template <class SymbolFn, class ShortcutFn>
+    void traverse( const DerivationDag & dag, float size, SymbolFn symbol, ShortcutFn shortcut ) const
+    {
+        struct Frame
+        {
+            uint32_t node;
+            uint32_t pos;
+        };
+
+        std::vector<Frame> stack;
+        Frame f = { dag.root, 0 };
+        stack.push_back(f);
+        while( !stack.empty() )
+        {
+            Frame & top = stack.back();
+            const DerivationDag::Node & node = dag.nodes[top.node];
+            if( top.pos == node.count )
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            uint32_t id = dag.edges[node.begin + top.pos++];
+            const DerivationDag::Node & child = dag.nodes[id];
+            const Summary & s = summaries[id];
+            if( child.depth == 0 )
+            {
+                symbol(child.symbol);
+            }
+            else if( !child.count )
+            {
+                continue;
+            }
+            else if( s.collapsible && s.radius < size )
+            {
+                shortcut(s);
+            }
+            else
+            {
+                Frame c = { id, 0 };
+                stack.push_back(c);
+            }
+        }
+    }
+
+    /// Predicted output of traverse() with a given size: the moves and segments it emits, a shortcut
+    /// counting as one segment (or move if it doesn't draw). Exact, computed bottom up over the nodes
+    /// so the cost is that of the DAG rather than of the derivation.
+    GrowthEstimate estimate( const DerivationDag & dag, const TurtleProgram & program, float size ) const
+    {
+        // per node, children always have lower ids than their parents
+        std::vector<double> segments(dag.nodes.size(), 0.0), moves(dag.nodes.size(), 0.0);
+        for( uint32_t i = 0; i < dag.nodes.size(); i++ )
+        {
+            const DerivationDag::Node & node = dag.nodes[i];
+            if( node.depth == 0 )
+            {
+                int op = TurtleProgram::opcode(program.symbols[(unsigned char)node.symbol]);
+                segments[i] = op == TurtleProgram::OP_F;
+                moves[i] = op == TurtleProgram::OP_f;
+                continue;
+            }
+            for( uint32_t j = 0; j < node.count; j++ )
+            {
+                uint32_t c = dag.edges[node.begin + j];
+                const DerivationDag::Node & child = dag.nodes[c];
+                const Summary & s = summaries[c];
+                if( child.depth > 0 && child.count && s.collapsible && s.radius < size )
+                {
+                    (s.draws ? segments[i] : moves[i]) += 1.0;
+                    continue;
+                }
+                segments[i] += segments[c];
+                moves[i] += moves[c];
+            }
+        }
+
+        GrowthEstimate res;
+        if( !dag.nodes.empty() )
+        {
+            res.counts[(unsigned char)'F'] = segments[dag.root];
+            res.counts[(unsigned char)'f'] = moves[dag.root];
+            res.length = res.count('F') + res.count('f');
+        }
+        return res;
+    }
+
+    /// Smallest size from size up for which traverse() emits a mesh of at most max_bytes, so zooming in
+    /// refines the detail until the budget is reached. Doubles the size until the mesh fits, then bisects.
+    /// Returns a size whose mesh is still over max_bytes if nodes that can't be summarized don't fit
+    float fit( const DerivationDag & dag, const TurtleProgram & program, float size, double max_bytes ) const
+    {
+        if( estimate(dag, program, size).mesh_bytes() <= max_bytes )
+            return size;
+
+        // collapsing more nodes never emits more, so the mesh shrinks as the size grows
+        float lo = size, hi = size;
+        for( int i = 0; i < 64; i++ )
+        {
+            lo = hi;
+            hi *= 2;
+            if( estimate(dag, program, hi).mesh_bytes() <= max_bytes )
+                break;
+        }
+        for( int i = 0; i < 8; i++ )
+        {
+            float mid = 0.5f*(lo + hi);
+            if( estimate(dag, program, mid).mesh_bytes() <= max_bytes )
+                hi = mid;
+            else
+                lo = mid;
+        }
+        return hi;
+    }
+
+    std::vector<Summary> summaries;
+
+private:
+    struct State
+    {
+        double x, y;
+        int turns;
+    };
+
+    static double radians( double deg ) { return deg*(3.14159265358979323846/180.0); }
+
+    Summary summarize( const DerivationDag & dag, const TurtleProgram & program, uint32_t id ) const
+    {
+        const DerivationDag::Node & node = dag.nodes[id];
+        Summary res = { 0, 0, 0, 0, false, true };
+        if( node.depth == 0 )
+        {
+            // a symbol on its own, brackets can't be summarized
+            int op = TurtleProgram::opcode(program.symbols[(unsigned char)node.symbol]);
+            State s = { 0, 0, 0 };
+            switch( op )
+            {
+                case TurtleProgram::OP_F:
+                case TurtleProgram::OP_f:
+                    s.y = 1;
+                    res.draws = op == TurtleProgram::OP_F;
+                    break;
+                case TurtleProgram::OP_PLUS:
+                    s.turns = 1;
+                    break;
+                case TurtleProgram::OP_MINUS:
+                    s.turns = -1;
+                    break;
+                case TurtleProgram::OP_NONE:
+                    break;
+                default:
+                    res.collapsible = false;
+                    break;
+            }
+            res.y = s.y;
+            res.radius = s.y;
+            res.turns = s.turns;
+            return res;
+        }
+
+        std::vector<State> stack(1);
+        State start = { 0, 0, 0 };
+        stack[0] = start;
+        double radius = 0;
+        for( uint32_t j = 0; j < node.count; j++ )
+        {
+            uint32_t c = dag.edges[node.begin + j];
+            const DerivationDag::Node & child = dag.nodes[c];
+            if( child.depth == 0 )
+            {
+                int op = TurtleProgram::opcode(program.symbols[(unsigned char)child.symbol]);
+                if( op == TurtleProgram::OP_PUSH )
+                {
+                    stack.push_back(stack.back());
+                    continue;
+                }
+                if( op == TurtleProgram::OP_POP )
+                {
+                    if( stack.size() < 2 )
+                    {
+                        res.collapsible = false;
+                        return res;
+                    }
+                    stack.pop_back();
+                    continue;
+                }
+            }
+
+            const Summary & cs = summaries[c];
+            if( !cs.collapsible )
+            {
+                res.collapsible = false;
+                return res;
+            }
+
+            // the child's end state, rotated to the current heading
+            State & s = stack.back();
+            double a = radians(90.0 + s.turns*angle);
+            double dx = cos(a), dy = sin(a);
+            radius = std::max(radius, sqrt(s.x*s.x + s.y*s.y) + cs.radius);
+            s.x += cs.x*dy + cs.y*dx;
+            s.y += -cs.x*dx + cs.y*dy;
+            s.turns += cs.turns;
+            res.draws |= cs.draws;
+        }
+
+        if( stack.size() != 1 )
+        {
+            res.collapsible = false;
+            return res;
+        }
+        res.x = stack[0].x;
+        res.y = stack[0].y;
+        res.turns = stack[0].turns;
+        // rounding must not make the bound smaller
+        res.radius = radius*(1.0 + 1e-6);
+        return res;
+    }
+
+    double angle = 0;
+};
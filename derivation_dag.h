@@ -0,0 +1,297 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Grammar compressed derivation.
+/// The derivation tree is stored as a DAG (a straight-line grammar): the expansion of a deterministic
+/// symbol with k remaining iterations is always the same, so it is stored once as a node
+/// (symbol, k) and shared by all of its occurrences. Symbols whose expansion involves a stochastic
+/// production are expanded per instance, with their children again shared where possible.
+/// For D0L systems the number of nodes grows linearly with n, rather than exponentially.
+class DerivationDag
+{
+public:
+    struct Node
+    {
+        char symbol;
+        int depth;          // remaining iterations, 0 for leaves
+        uint32_t begin;     // children in edges[begin, begin+count)
+        uint32_t count;
+    };
+
+    /// Builds the DAG for n iterations of axiom
+    void build( const ProductionTable & table, const std::string & axiom, int n )
+    {
+        this->table = &table;
+        this->n = n;
+
+        nodes.clear();
+        edges.clear();
+        shared.assign(256*(n+1), NONE);
+        index.assign(n+1, 0);
+
+        find_pure();
+        compute_widths();
+
+        // root has the axiom symbols as children
+        std::vector<uint32_t> children;
+        for( int i = 0; i < axiom.length(); i++ )
+            children.push_back(instance(axiom[i], 0));
+        root = add_node(0, n+1, children);
+    }
+
+    /// Calls emit(symbol) for every symbol of the last generation, in order
+    template <class Fn>
+    void traverse( Fn emit ) const
+    {
+        struct Frame
+        {
+            uint32_t node;
+            uint32_t pos;
+        };
+
+        std::vector<Frame> stack;
+        stack.reserve(n+2);
+        Frame f = { root, 0 };
+        stack.push_back(f);
+        while( !stack.empty() )
+        {
+            Frame & top = stack.back();
+            const Node & node = nodes[top.node];
+            if( top.pos == node.count )
+            {
+                stack.pop_back();
+                continue;
+            }
+
+            uint32_t id = edges[node.begin + top.pos++];
+            const Node & child = nodes[id];
+            if( child.depth == 0 )
+            {
+                emit(child.symbol);
+            }
+            else if( child.count )
+            {
+                Frame c = { id, 0 };
+                stack.push_back(c);
+            }
+        }
+    }
+
+    /// Number of symbols in each node's expansion, computed bottom up on the DAG
+    std::vector<uint64_t> node_lengths() const
+    {
+        // children always have lower ids than their parents
+        std::vector<uint64_t> len(nodes.size(), 0);
+        for( uint32_t i = 0; i < nodes.size(); i++ )
+        {
+            const Node & node = nodes[i];
+            if( node.depth == 0 )
+            {
+                len[i] = 1;
+                continue;
+            }
+            for( uint32_t j = 0; j < node.count; j++ )
+                len[i] += len[edges[node.begin+j]];
+        }
+        return len;
+    }
+
+    /// Length of the last generation
+    uint64_t length() const
+    {
+        if( nodes.empty() )
+            return 0;
+        return node_lengths()[root];
+    }
+
+    /// Number of occurrences of each symbol in the last generation
+    void symbol_counts( uint64_t counts[256] ) const
+    {
+        for( int i = 0; i < 256; i++ )
+            counts[i] = 0;
+        if( nodes.empty() )
+            return;
+
+        // propagate multiplicities top down
+        std::vector<uint64_t> mult(nodes.size(), 0);
+        mult[root] = 1;
+        for( int i = (int)nodes.size()-1; i >= 0; i-- )
+        {
+            const Node & node = nodes[i];
+            if( node.depth == 0 )
+            {
+                counts[(unsigned char)node.symbol] += mult[i];
+                continue;
+            }
+            for( uint32_t j = 0; j < node.count; j++ )
+                mult[edges[node.begin+j]] += mult[i];
+        }
+    }
+
+    /// Approximate memory used by the DAG in bytes
+    size_t memory() const
+    {
+        return nodes.size()*sizeof(Node) + edges.size()*sizeof(uint32_t);
+    }
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> edges;
+    uint32_t root = 0;
+
+private:
+    enum { NONE = 0xffffffff };
+
+    uint32_t add_node( char symbol, int depth, const std::vector<uint32_t> & children )
+    {
+        Node node = { symbol, depth, (uint32_t)edges.size(), (uint32_t)children.size() };
+        edges.insert(edges.end(), children.begin(), children.end());
+        nodes.push_back(node);
+        return nodes.size()-1;
+    }
+
+    /// Successor string of a deterministic symbol (the symbol itself if it has no production)
+    void successor( char a, const char * & str, size_t & len ) const
+    {
+        const ProductionTable::Rule & r = table->rule(a);
+        switch( r.type )
+        {
+            case ProductionTable::RULE_SKIP:
+                str = 0;
+                len = 0;
+                break;
+            case ProductionTable::RULE_DETERMINISTIC:
+                str = r.str;
+                len = r.len;
+                break;
+            default:
+                str = 0;
+                len = 1;
+                break;
+        }
+    }
+
+    /// A symbol is pure if its expansion never involves a stochastic production
+    void find_pure()
+    {
+        for( int a = 0; a < 256; a++ )
+            pure[a] = table->rules[a].type != ProductionTable::RULE_STOCHASTIC;
+
+        bool changed = true;
+        while( changed )
+        {
+            changed = false;
+            for( int a = 0; a < 256; a++ )
+            {
+                const ProductionTable::Rule & r = table->rules[a];
+                if( !pure[a] || r.type != ProductionTable::RULE_DETERMINISTIC )
+                    continue;
+                for( size_t i = 0; i < r.len; i++ )
+                {
+                    if( !pure[(unsigned char)r.str[i]] )
+                    {
+                        pure[a] = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    /// widths[a*(n+1)+j]: number of symbols j iterations below a pure symbol a
+    void compute_widths()
+    {
+        widths.assign(256*(n+1), 0);
+        for( int a = 0; a < 256; a++ )
+            widths[a*(n+1)] = 1;
+
+        for( int j = 1; j <= n; j++ )
+        {
+            for( int a = 0; a < 256; a++ )
+            {
+                if( !pure[a] )
+                    continue;
+                const char * str;
+                size_t len;
+                successor(a, str, len);
+                uint64_t w = 0;
+                if( !str )
+                    w = len ? widths[a*(n+1)+j-1] : 0;
+                else
+                    for( size_t i = 0; i < len; i++ )
+                        w += widths[(unsigned char)str[i]*(n+1)+j-1];
+                widths[a*(n+1)+j] = w;
+            }
+        }
+    }
+
+    /// Node for symbol a, occurring in generation level
+    uint32_t instance( char a, int level )
+    {
+        int k = n - level;
+        unsigned char c = a;
+        if( k == 0 || pure[c] )
+        {
+            // skip over the symbols this expansion contributes to each generation,
+            // so the indices of later stochastic symbols match those of the full derivation
+            for( int j = 0; j < k; j++ )
+                index[level+j] += widths[c*(n+1)+j];
+            return shared_node(a, k);
+        }
+
+        uint64_t i = index[level]++;
+        const ProductionTable::Rule & r = table->rule(a);
+
+        const char * str = 0;
+        size_t len = 0;
+        if( r.type == ProductionTable::RULE_STOCHASTIC )
+        {
+            const std::string & s = r.production->successors[table->choose(r, level, i)];
+            str = s.c_str();
+            len = s.length();
+        }
+        else
+        {
+            successor(a, str, len);
+        }
+
+        std::vector<uint32_t> children;
+        for( size_t j = 0; j < len; j++ )
+            children.push_back(instance(str[j], level+1));
+        return add_node(a, k, children);
+    }
+
+    /// Shared node for a pure symbol a with k remaining iterations
+    uint32_t shared_node( char a, int k )
+    {
+        unsigned char c = a;
+        const char * str;
+        size_t len;
+        successor(a, str, len);
+
+        // symbols without production expand to themselves
+        if( !str && len )
+            k = 0;
+
+        if( shared[c*(n+1)+k] != NONE )
+            return shared[c*(n+1)+k];
+
+        std::vector<uint32_t> children;
+        if( k > 0 )
+            for( size_t j = 0; j < len; j++ )
+                children.push_back(shared_node(str[j], k-1));
+
+        uint32_t res = add_node(a, k, children);
+        shared[c*(n+1)+k] = res;
+        return res;
+    }
+
+    const ProductionTable * table = 0;
+    int n = 0;
+
+    bool pure[256];
+    std::vector<uint64_t> widths;
+    std::vector<uint32_t> shared;
+    // index of the next symbol in each generation
+    std::vector<uint64_t> index;
+};
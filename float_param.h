@@ -0,0 +1,55 @@
+#pragma once
+
+#include "counter_rng.h"
+
+/// Float value wrapper. allows to randomly select from a set of values.
+/// Values are drawn with a counter based generator, so the i-th draw only depends on the seed.
+class FloatParam
+{
+public:
+    FloatParam( float v = 0.0 )
+    {
+        values.push_back(v);
+    }
+    
+    FloatParam(const std::string &value)
+    {
+        string_vector S = split(value,",");
+        if(S.size() == 0)
+            S.push_back(value);
+        for( int i=0; i < S.size(); i++ )
+            values.push_back(atof(S[i].c_str()));
+    }
+    
+    /// Next value in the sequence
+    operator float() const
+    {
+        return at(draws++);
+    }
+    
+    /// i-th value in the sequence
+    float at( uint64_t i ) const
+    {
+        if(!values.size())
+            return 0.0;
+        if(values.size() == 1)
+            return values[0];
+        
+        int j = counter_uniform(seed, RNG_STREAM_PARAM, 0, i) * values.size();
+        return values[ std::min(j, (int)values.size()-1) ];
+    }
+    
+    /// Restarts the sequence of values
+    void restart( uint64_t i = 0 ) const { draws = i; }
+    
+    const FloatParam & operator = (float v)
+    {
+        values.clear();
+        values.push_back(v);
+        return *this;
+    }
+    
+    std::vector<float> values;
+    uint64_t seed = 0;
+    mutable uint64_t draws = 0;
+};
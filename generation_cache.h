@@ -0,0 +1,92 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Cache of derived generations of an l-system.
+/// Total memory is kept under a budget by evicting the least recently used generations.
+class GenerationCache
+{
+public:
+    void clear()
+    {
+        entries.clear();
+        bytes = 0;
+    }
+
+    /// Highest cached generation not above n, -1 if none
+    int nearest( int n ) const
+    {
+        std::map<int, Entry>::const_iterator it = entries.upper_bound(n);
+        if( it == entries.begin() )
+            return -1;
+        --it;
+        return it->first;
+    }
+
+    /// Cached generation n, or 0 if not present
+    const std::string * get( int n )
+    {
+        std::map<int, Entry>::iterator it = entries.find(n);
+        if( it == entries.end() )
+            return 0;
+        it->second.last_use = ++clock;
+        return &it->second.str;
+    }
+
+    /// Stores a copy of generation n, evicting older entries if needed.
+    /// Generations larger than the budget are not stored.
+    void put( int n, const std::string & str )
+    {
+        if( str.length() > budget )
+            return;
+
+        std::map<int, Entry>::iterator it = entries.find(n);
+        if( it != entries.end() )
+        {
+            bytes -= it->second.str.length();
+            entries.erase(it);
+        }
+
+        while( bytes + str.length() > budget )
+            evict();
+
+        Entry & e = entries[n];
+        e.str = str;
+        e.last_use = ++clock;
+        bytes += str.length();
+    }
+
+    /// Sets the memory budget, evicting the least recently used generations until they fit
+    void set_budget( size_t bytes )
+    {
+        budget = bytes;
+        while( this->bytes > budget )
+            evict();
+    }
+
+    /// Seed the cached generations were derived with
+    uint64_t seed = 0;
+    /// Memory budget in bytes, Lsystem::produce() sets it from what a derivation leaves of its budget
+    size_t budget = (size_t)512<<20;
+    /// Memory currently used in bytes
+    size_t bytes = 0;
+
+private:
+    void evict()
+    {
+        std::map<int, Entry>::iterator lru = entries.begin();
+        for( std::map<int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it )
+            if( it->second.last_use < lru->second.last_use )
+                lru = it;
+        bytes -= lru->second.str.length();
+        entries.erase(lru);
+    }
+
+    struct Entry
+    {
+        std::string str;
+        uint64_t last_use;
+    };
+
+    std::map<int, Entry> entries;
+    uint64_t clock = 0;
+};
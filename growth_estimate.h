@@ -0,0 +1,108 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Closed form prediction of the size of a derivation, computed before deriving anything.
+/// Each iteration maps the Parikh vector (number of occurrences of each symbol) of a generation
+/// to the next through the production matrix, M[a][b] being the number of b's in the successor of a.
+/// For stochastic productions the expected number is used, weighting each successor by its probability.
+/// The cost is proportional to n times the size of the productions, independently of the output size.
+/// Counts are exact for deterministic l-systems and expected values for stochastic ones.
+struct GrowthEstimate
+{
+    enum
+    {
+        // bytes per vertex stored by QuickMesh: the point itself plus its default packing in the GL buffer (x, y floats)
+        MESH_VERTEX_BYTES = sizeof(float)*3 + sizeof(float)*2
+    };
+
+    /// Predicts generation n of axiom
+    void compute( const ProductionTable & table, const std::string & axiom, int n )
+    {
+        std::vector<double> cur(256, 0.0), next(256, 0.0);
+        for( size_t i = 0; i < axiom.length(); i++ )
+            cur[(unsigned char)axiom[i]] += 1.0;
+
+        // the first length is the axiom as it is, the table drops whitespace from then on
+        previous_length = length = axiom.length();
+        for( int k = 0; k < n; k++ )
+        {
+            std::fill(next.begin(), next.end(), 0.0);
+            for( int a = 0; a < 256; a++ )
+            {
+                if( cur[a] == 0.0 )
+                    continue;
+                const ProductionTable::Rule & r = table.rules[a];
+                switch( r.type )
+                {
+                    case ProductionTable::RULE_IDENTITY:
+                        next[a] += cur[a];
+                        break;
+                    case ProductionTable::RULE_DETERMINISTIC:
+                        add(next, r.str, r.len, cur[a]);
+                        break;
+                    case ProductionTable::RULE_STOCHASTIC:
+                    {
+                        const Production & p = *r.production;
+                        double sum = 0.0;
+                        for( size_t j = 0; j < p.weights.size(); j++ )
+                            sum += p.weights[j];
+                        if( sum <= 0.0 )
+                            break;
+                        for( size_t j = 0; j < p.successors.size(); j++ )
+                            add(next, p.successors[j].c_str(), p.successors[j].length(), cur[a]*p.weights[j]/sum);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            std::swap(cur, next);
+
+            previous_length = length;
+            length = 0.0;
+            for( int a = 0; a < 256; a++ )
+                length += cur[a];
+        }
+
+        for( int a = 0; a < 256; a++ )
+            counts[a] = cur[a];
+    }
+
+    /// Occurrences of symbol a in the last generation
+    double count( char a ) const { return counts[(unsigned char)a]; }
+
+    /// Segments drawn by the turtle, one for each F
+    double segments() const { return count('F'); }
+
+    /// Turtle moves, with or without drawing
+    double moves() const { return count('F') + count('f'); }
+
+    /// Vertices emitted by a line renderer, before merging collinear segments
+    double line_vertices() const { return 2.0*segments(); }
+
+    /// Bytes needed to derive the last generation as a string:
+    /// the last two generations in the ping-pong buffers plus the compiled program (at most a byte per symbol).
+    /// Cached generations are not included, Lsystem::produce() gives the cache part of what is left of the budget.
+    double derivation_bytes() const { return 2.0*length + previous_length; }
+
+    /// Bytes needed for the line mesh
+    double mesh_bytes() const { return line_vertices()*MESH_VERTEX_BYTES; }
+
+    /// Prints a summary of the estimate
+    void print( int n ) const
+    {
+        printf("Generation %d: ~%.0f symbols, ~%.0f segments, ~%.1f MB derivation, ~%.1f MB mesh\n",
+               n, length, segments(), derivation_bytes()/(1<<20), mesh_bytes()/(1<<20));
+    }
+
+    double counts[256] = {0};
+    double length = 0.0;
+    double previous_length = 0.0;
+
+private:
+    static void add( std::vector<double> & dst, const char * str, size_t len, double w )
+    {
+        for( size_t i = 0; i < len; i++ )
+            dst[(unsigned char)str[i]] += w;
+    }
+};
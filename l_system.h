@@ -1,39 +1,14 @@
 #pragma once
 
-/// Float value wrapper. allows to randomly select from a set of values.
-class FloatParam
-{
-public:
-    FloatParam( float v = 0.0 )
-    {
-        values.push_back(v);
-    }
-    
-    FloatParam(const std::string &value)
-    {
-        string_vector S = split(value,",");
-        if(S.size() == 0)
-            S.push_back(value);
-        for( int i=0; i < S.size(); i++ )
-            values.push_back(atof(S[i].c_str()));
-    }
-    
-    operator float() const
-    {
-        if(!values.size())
-            return 0.0;
-        
-        return values[ rand()%values.size() ];
-    }
-    
-    const FloatParam & operator = (float v)
-    {
-        values.clear();
-        values.push_back(v);
-    }
-    
-    std::vector<float> values;
-};
+#include "production.h"
+#include "growth_estimate.h"
+#include "derivation_dag.h"
+#include "generation_cache.h"
+#include "turtle_program.h"
+#include "peephole.h"
+#include "float_param.h"
+#include "turtle_2d.h"
+#include "dag_lod.h"
 
 ///////////////////////////////////////////////////////
 /// Empty Lsystem renderer
@@ -43,6 +18,9 @@ public:
     virtual void begin() {}
     virtual void end() {}
     
+    /// Called after begin() with the predicted size of the derivation, so storage can be allocated upfront
+    virtual void reserve( const GrowthEstimate & estimate ) {}
+    
 	virtual void F() {}
 	virtual void f() {}
 	virtual void plus() {}
@@ -50,32 +28,50 @@ public:
 	virtual void push() {}
 	virtual void pop() {}
     
+    // Runs of n commands, by default these repeat the single commands.
+    // Renderers can override them to handle a run at once, e.g. a single segment for FFF
+    virtual void F_run( int n ) { for( int i = 0; i < n; i++ ) F(); }
+    virtual void f_run( int n ) { for( int i = 0; i < n; i++ ) f(); }
+    /// n > 0 for + and n < 0 for -
+    virtual void rotate( int n )
+    {
+        for( int i = 0; i < n; i++ ) plus();
+        for( int i = 0; i < -n; i++ ) minus();
+    }
+    
+    /// Interprets a whole program at once, e.g. in parallel with a thread pool (which may be null).
+    /// Returns false if not supported, in which case the program is executed command by command
+    virtual bool run_program( const TurtleProgram & program, ThreadPool * pool ) { return false; }
+    
+    /// Interprets a batch of n commands. By default each goes through the virtual run interface above,
+    /// renderers can override this to handle the whole array at once
+    virtual void consume( const TurtleProgram::Op * ops, size_t n ) { TurtleProgram::dispatch(ops, n, this); }
+    
+    /// Replaces a part of the derivation too small to be seen (see DagLod): moves to (x, y) relative to the
+    /// current position and heading, drawing a line there if the part draws anything, then turns n times
+    virtual void shortcut( float x, float y, int n, bool draw ) {}
+    
     FloatParam delta=20.0; // Angle, the FloatParam allows for randomization
     float delta_offset=0.0;
     int d=1;
+    
+    // bytes the renderer may use for its own caches, what the derivation and the mesh leave of the
+    // memory budget. Set by Lsystem::render() before reserve(), caches that would not fit are not built
+    double cache_budget = HUGE_VAL;
 };
 
-
 ///////////////////////////////////////////////////////
-/// Production rule for a given predecessor a
-/// Multiple successors can be specified with weights determining the likelyhood of being samples.
-struct Production
+/// Base for renderers with statically dispatched commands (CRTP), Derived being the final renderer class.
+/// Batches of commands are dispatched to Derived directly, and Lsystem::render(Derived*)
+/// calls consume() without going through the vtable, so turtle commands are inlined.
+template <class Derived>
+class BatchRenderer : public LsystemRenderer
 {
-	char a;
-
-    std::vector<float> weights;
-	std::vector<std::string> successors;
-
-	std::string successor()
-	{
-		// return same in case
-		if( successors.size() < 1 )
-		{
-			return std::string(1,a);
-		}
-        
-        return weighted_sample(successors, weights);
-	}
+public:
+    void consume( const TurtleProgram::Op * ops, size_t n )
+    {
+        TurtleProgram::dispatch(ops, n, static_cast<Derived*>(this));
+    }
 };
 
 
@@ -95,18 +91,28 @@ public:
 	Lsystem()
 	{
         // create our alphabet
-        alphabet['F'] = std::bind(&Lsystem::F, this, std::placeholders::_1 );
-		alphabet['f'] = std::bind(&Lsystem::f, this, std::placeholders::_1 );
-		alphabet['+'] = std::bind(&Lsystem::plus, this, std::placeholders::_1 );
-		alphabet['-'] = std::bind(&Lsystem::minus, this, std::placeholders::_1 );
-		alphabet['['] = std::bind(&Lsystem::push, this, std::placeholders::_1 );
-		alphabet[']'] = std::bind(&Lsystem::pop, this, std::placeholders::_1 );
+        alphabet['F'] = builtin(TurtleProgram::OP_F, &Lsystem::F);
+		alphabet['f'] = builtin(TurtleProgram::OP_f, &Lsystem::f);
+		alphabet['+'] = builtin(TurtleProgram::OP_PLUS, &Lsystem::plus);
+		alphabet['-'] = builtin(TurtleProgram::OP_MINUS, &Lsystem::minus);
+		alphabet['['] = builtin(TurtleProgram::OP_PUSH, &Lsystem::push);
+		alphabet[']'] = builtin(TurtleProgram::OP_POP, &Lsystem::pop);
         
         // additional symbols can be added by overriding this class
         // and adding entries with corresponding functions, and overriding
         // get_renderer/set_renderer with an apporpriate extended renderer.
+        // The symbols above are compiled to builtin turtle instructions,
+        // other entries, including ones replacing them, are called through the extension table of TurtleProgram.
+        // Erasing an entry makes its symbol ignored.
 	}
     
+    /// Alphabet entry of a builtin turtle command, compiled to its instruction (see TurtleProgram::Builtin)
+    TurtleProgram::Extension builtin( int op, void (Lsystem::*fn)( LsystemRenderer * ) )
+    {
+        TurtleProgram::Builtin b = { op, std::bind(fn, this, std::placeholders::_1) };
+        return b;
+    }
+    
     /// Parses an l-system description file
     bool parse_file( const std::string & path )
     {
@@ -124,6 +130,7 @@ public:
         string_vector lines = lines_;
         
         default_params.clear();
+        has_seed = false;
         
         // optionally the first line can specify default l-system parameters
         std::string params = string_between(lines[0],'{','}');
@@ -139,6 +146,12 @@ public:
             string_vector p = split(P[i],":");
             if( p.size() != 2 )
                 continue;
+            if( p[0] == "seed" )
+            {
+                seed = strtoull(p[1].c_str(), 0, 10);
+                has_seed = true;
+                continue;
+            }
             default_params[p[0]] = FloatParam(p[1].c_str());
         }
         
@@ -150,7 +163,14 @@ public:
     /// Parse an L-System specification string
 	bool parse( const std::string& str )
 	{
+        // derived generations stay valid if we reload the same grammar with a fixed seed
+        GenerationCache keep;
+        bool same = str == source && has_seed;
+        if( same )
+            std::swap(keep, cache);
+        
         clear();
+        source = str;
         
 		std::vector<std::string> lines = split(str,"\n");
 		if( lines.size() < 2 )
@@ -161,6 +181,14 @@ public:
         
         lines = check_params(lines);
         
+        // without a seed in the parameters, each parse gives a new random variation
+        if( !has_seed )
+            seed = ((uint64_t)lrand48() << 32) ^ (uint64_t)lrand48() ^ (uint64_t)time(0);
+        printf("Seed: %llu\n", (unsigned long long)seed);
+        
+        for( std::map<std::string, FloatParam>::iterator it = default_params.begin(); it != default_params.end(); ++it )
+            it->second.seed = seed;
+        
         axiom = lines[0];
 
 		P.clear();
@@ -172,6 +200,9 @@ public:
 				printf("Error in line %d\n",i);
 			}
 		}
+        
+        if( same )
+            std::swap(keep, cache);
 
 		return true;
 	}
@@ -201,91 +232,340 @@ public:
 		if(weight_str!="")
 			w = atof(weight_str.c_str());
 		
+        // cached generations are no longer valid
+        cache.clear();
+        
 		// add or update proudction
 		if( in(a, P) )
 		{
 			Production & p = P[a];
 			p.successors.push_back(chi);
 			p.weights.push_back(w);	
+            p.build_sampler();
 		}
 		else
 		{
 			Production p;
 			p.successors.push_back(chi);
 			p.weights.push_back(w);	
+            p.build_sampler();
 			P[a] = p;
 		}
         
         return true;
 	}
     
-    /// Run a production iteration on string
-	std::string produce( const std::string & str )
+    /// Run a production iteration on string, generation selects the random choices of stochastic productions
+	std::string produce( const std::string & str, unsigned generation=0 )
+	{
+        std::string res;
+        table.build(P);
+        table.seed = seed;
+        table.rewrite(str.c_str(), str.length(), res, generation);
+		return res;
+	}
+    
+    /// Run n iterations starting from the axiom.
+    /// The size of the result is predicted first. If the mesh would not fit in memory_budget nothing is derived
+    /// and false is returned, if only the derived strings would not fit this derivation is streamed instead
+    /// (see active_derivation), derivation keeps the mode that was asked for. Cached generations are kept
+    /// within what is left of the budget.
+	bool produce( int n )
 	{
-        std::string res = "";
+        GrowthEstimate est = estimate(n);
+        if( verbose )
+            est.print(n);
         
-		for( int i = 0; i < str.length(); i++ )
-		{
-            char a = str[i];
-            
-            // skip whitespaces tabs etc..
-            if( !isalnum(a) && !ispunct(a) )
-                continue;
+        double budget = budget_bytes();
+        bool lod_active = lod_bounded();
+        if( !fits(est) )
+        {
+            printf("Over the memory budget of %g MB, not deriving\n", memory_budget);
+            return false;
+        }
+        
+        int mode = derivation;
+        if( mode == DERIVE_STRING && est.derivation_bytes() + est.mesh_bytes() > budget )
+        {
+            printf("Derived strings would not fit in the memory budget of %g MB, streaming this derivation\n", memory_budget);
+            mode = DERIVE_STREAM;
+        }
+        else if( !lod_active && est.derivation_bytes() + est.mesh_bytes() > budget*0.5 )
+        {
+            printf("Warning, using more than half of the memory budget\n");
+        }
+        
+        // the cache of generations gets half of what the derivation and the mesh leave of the budget,
+        // the rest is for the caches of renderers
+        double left = budget - est.mesh_bytes() - (mode == DERIVE_STRING ? est.derivation_bytes() : 0);
+        cache.set_budget((size_t)std::max(0.0, 0.5*left));
+        
+        growth = est;
+        generations = n;
+        program.clear();
+        optimized_mode = -1;
+        program.set_alphabet(alphabet);
+        active_derivation = mode;
+        
+        // in streaming mode the derivation happens while rendering
+        if( mode == DERIVE_STREAM )
+            return true;
+        
+        if( mode == DERIVE_DAG )
+        {
+            dag.build(table, axiom, n);
+            lod.clear();
+            return true;
+        }
+        
+        if( cache.seed != seed )
+        {
+            cache.clear();
+            cache.seed = seed;
+        }
+        
+        // start from the highest generation we already have
+        int start = cache.nearest(n);
+        const std::string * str = start >= 0 ? cache.get(start) : 0;
+        if( !str )
+        {
+            start = 0;
+            str = &axiom;
+            cache.put(0, axiom);
+        }
+        
+        // ping-pong between two buffers, so their storage is reused across generations
+        int cur = 0;
+        for( int i = start; i < n; i++ )
+        {
+            table.rewrite(str->c_str(), str->length(), buffers[cur], i, pool);
+            str = &buffers[cur];
+            cur = 1-cur;
+            cache.put(i+1, *str);
+        }
+        
+        // symbols not in the alphabet are dropped here
+        program.compile(str->c_str(), str->length());
+        return true;
+	}
+
+    /// Predicts the size of generation n of the parsed l-system, without deriving anything
+    GrowthEstimate estimate( int n )
+    {
+        table.build(P);
+        table.seed = seed;
+        GrowthEstimate est;
+        est.compute(table, axiom, n);
+        return est;
+    }
+    
+    /// True if the mesh is bounded by level of detail rather than by the size of the derivation.
+    /// Stochastic expansions are stored one by one in the DAG, so they are still bounded by the mesh.
+    /// Needs the production table, built by estimate()
+    bool lod_bounded() const
+    {
+        return derivation == DERIVE_DAG && lod_size > 0 && !table.stochastic;
+    }
+    
+    /// True if produce() accepts a derivation of this estimate in the memory budget
+    bool fits( const GrowthEstimate & est ) const
+    {
+        return lod_bounded() || est.mesh_bytes() <= budget_bytes();
+    }
+    
+    /// Render parsed L-system with a given renderer.
+    /// Called with the final type of a BatchRenderer, e.g. render(line_renderer), commands are dispatched statically.
+    /// Through an LsystemRenderer pointer they go through its virtual interface, one call per batch of commands.
+    template <class Renderer>
+	void render( Renderer * renderer )
+	{
+        if( active_derivation == DERIVE_STREAM )
+        {
+            stream(generations, renderer);
+            return;
+        }
+        
+        // level of detail needs a fixed angle, storage is then sized for what the traversal emits
+        bool use_lod = active_derivation == DERIVE_DAG && lod_size > 0 && renderer->delta.values.size() < 2;
+        float d = renderer->d;
+        float size = lod_size/d;
+        GrowthEstimate visible;
+        if( use_lod )
+        {
+            double angle = Turtle2d::snap_angle((renderer->delta.values.size() ? renderer->delta.values[0] : 0.0f)
+                                                + renderer->delta_offset);
+            if( lod.empty() || lod.get_angle() != angle )
+                lod.compute(dag, program, angle);
             
-            if(in(a, P))
+            // past the budget, detail stops getting finer when zooming in
+            size = lod.fit(dag, program, size, budget_bytes());
+            visible = lod.estimate(dag, program, size);
+            if( visible.mesh_bytes() > budget_bytes() )
+            {
+                printf("Over the memory budget of %g MB with level of detail, not rendering\n", memory_budget);
+                return;
+            }
+            if( size > lod_size/d )
+                printf("Level of detail limited to %g by the memory budget of %g MB\n", size*d, memory_budget);
+        }
+        else if( active_derivation == DERIVE_DAG && lod_size > 0 && growth.mesh_bytes() > budget_bytes() )
+        {
+            printf("Level of detail needs a fixed angle, over the memory budget of %g MB, not rendering\n", memory_budget);
+            return;
+        }
+        
+        // same random angles for each render
+        renderer->delta.restart();
+        renderer->begin();
+        const GrowthEstimate & reserved = use_lod ? visible : growth;
+        renderer->cache_budget = std::max(0.0, budget_bytes() - reserved.mesh_bytes() - derivation_memory());
+        renderer->reserve(reserved);
+        if( active_derivation == DERIVE_DAG )
+        {
+            TurtleProgram::Batch<Renderer> batch(program, renderer);
+            if( use_lod )
             {
-                Production & e = P[str[i]];
-                res += e.successor();
+                lod.traverse(dag, size, [&]( char a ) {
+                    batch.symbol(a);
+                }, [&]( const DagLod::Summary & s ) {
+                    batch.flush();
+                    renderer->shortcut(s.x*d, s.y*d, s.turns, s.draws);
+                });
             }
             else
             {
-                res += std::string(1, a);
+                dag.traverse([&]( char a ) {
+                    batch.symbol(a);
+                });
             }
-		}
-        
-		return res;
+            batch.flush();
+        }
+        else
+        {
+            const TurtleProgram & prog = optimized(renderer);
+            if( !renderer->run_program(prog, pool) )
+                prog.run(renderer);
+        }
+        renderer->end();
 	}
     
-    /// Run n iterations starting from the axiom
-	void produce( int n )
-	{
-		std::string str = axiom;
-        for( int i = 0; i < n; i++ )
+    /// Compiled program, peephole optimized for a renderer.
+    /// Rotations are only folded if the renderer uses a fixed angle
+    const TurtleProgram & optimized( LsystemRenderer * renderer )
+    {
+        if( !peephole )
+            return program;
+        
+        int mode = renderer->delta.values.size() < 2;
+        if( mode != optimized_mode )
         {
-            //printf("%d: %s -->", i+1, str.c_str());
-			str = produce(str);
-            //printf("%s\n", str.c_str());
+            PeepholeOptimizer opt;
+            opt.optimize(program, optimized_program, mode);
+            optimized_mode = mode;
         }
+        return optimized_program;
+    }
+    
+    /// Derives n iterations depth first, feeding the symbols of the last generation to the renderer
+    /// in small batches as they are produced. No generation is stored, the stack holds one frame
+    /// (a successor and a cursor in it) per generation, so memory is independent of the output size.
+    /// Symbols of each generation are visited left to right, so stochastic choices are
+    /// the same as with produce(n).
+    template <class Renderer>
+    void stream( int n, Renderer * renderer )
+    {
+        table.build(P);
+        table.seed = seed;
         
-		l_system.clear();
-
-		for( int i = 0; i < str.length(); i++ )
-		{
-			if(in(str[i], alphabet))
-			{
-				l_system.push_back( alphabet[str[i]] );
-			}
-			else
-			{
-				//printf("%c not in alphabet!\n", str[i]);
-			}
-		}
-	}
-
-    /// Render parsed L-system with a given renderer
-	void render( LsystemRenderer * renderer )
-	{
+        program.set_alphabet(alphabet);
+        
+        struct Frame
+        {
+            const char * str;
+            size_t len;
+            size_t pos;
+        };
+        
+        std::vector<Frame> stack(n+1);
+        // index of the next symbol in each generation
+        std::vector<uint64_t> index(n+1, 0);
+        
+        renderer->delta.restart();
         renderer->begin();
-		for( int i = 0; i < l_system.size(); i++ )
-			l_system[i](renderer);
+        if( n == generations )
+            renderer->reserve(growth);
+        
+        TurtleProgram::Batch<Renderer> batch(program, renderer);
+        
+        Frame root = { axiom.c_str(), axiom.length(), 0 };
+        stack[0] = root;
+        int level = 0;
+        while( level >= 0 )
+        {
+            Frame & fr = stack[level];
+            if( fr.pos == fr.len )
+            {
+                level--;
+                continue;
+            }
+            
+            const char * a = fr.str + fr.pos++;
+            
+            if( level == n )
+            {
+                batch.symbol(*a);
+                continue;
+            }
+            
+            uint64_t i = index[level]++;
+            
+            const ProductionTable::Rule & r = table.rule(*a);
+            Frame child = { a, 1, 0 };
+            switch( r.type )
+            {
+                case ProductionTable::RULE_SKIP:
+                    continue;
+                case ProductionTable::RULE_DETERMINISTIC:
+                    child.str = r.str;
+                    child.len = r.len;
+                    break;
+                case ProductionTable::RULE_STOCHASTIC:
+                {
+                    const std::string & succ = r.production->successors[table.choose(r, level, i)];
+                    child.str = succ.c_str();
+                    child.len = succ.length();
+                    break;
+                }
+                default:
+                    break;
+            }
+            stack[++level] = child;
+        }
+        batch.flush();
+        
         renderer->end();
-	}
+    }
+    
+    /// Memory budget in bytes
+    double budget_bytes() const { return (double)memory_budget*(1<<20); }
+    
+    /// Bytes held by the last derivation, with the cached generations
+    double derivation_memory() const
+    {
+        if( active_derivation == DERIVE_STRING )
+            return growth.derivation_bytes() + cache.bytes;
+        if( active_derivation == DERIVE_DAG )
+            return dag.memory() + cache.bytes;
+        return cache.bytes;
+    }
     
     // Clear the L-System
     void clear()
     {
-        l_system.clear();
+        program.clear();
+        optimized_mode = -1;
         P.clear();
+        cache.clear();
     }
     
     bool has_default_param( const std::string & str )
@@ -298,13 +578,56 @@ public:
         return default_params[str];
     }
     
-	std::vector< std::function<void(LsystemRenderer*)> > l_system;
+    // derived l-system compiled to turtle commands
+    TurtleProgram program;
+    
+    // peephole optimized program, for fixed (1) or random (0) angles, -1 if not computed yet
+    bool peephole = true;
+    TurtleProgram optimized_program;
+    int optimized_mode = -1;
 	
 	std::string axiom;
     
 	std::map<char, Production> P;
+    ProductionTable table;
+    std::string buffers[2];
+    GenerationCache cache;
+    
+    // specification the l-system was parsed from
+    std::string source;
+    
+    // if set, large generations are rewritten and interpreted in parallel with this pool
+    ThreadPool * pool = 0;
+    
+    // number of iterations of the last call to produce(n)
+    int generations = 0;
+    // predicted size of the last generation
+    GrowthEstimate growth;
+    // memory allowed for a derivation and its mesh, in MB
+    float memory_budget = 1024;
+    // if set, produce() prints the predicted size of each derivation
+    bool verbose = false;
+    
+    enum
+    {
+        DERIVE_STRING = 0, // each generation is stored as a string
+        DERIVE_STREAM,     // derived depth first while rendering, nothing is stored
+        DERIVE_DAG         // deterministic expansions are stored once and shared
+    };
+    int derivation = DERIVE_STRING;
+    // mode of the last call to produce(n), derivation unless its strings didn't fit in the budget
+    int active_derivation = DERIVE_STRING;
+    DerivationDag dag;
+    // with a DAG and a fixed angle, parts of the derivation smaller than this (in world units) are drawn
+    // as a single segment, 0 to draw everything
+    float lod_size = 0;
+    DagLod lod;
 	std::map<char, std::function<void(LsystemRenderer*)> > alphabet;
     
     std::map<std::string, FloatParam> default_params;
+    
+    // seed for stochastic productions and parameters, can be set with "seed:<n>" in the parameters
+    uint64_t seed = 0;
+    bool has_seed = false;
 };
 
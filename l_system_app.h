@@ -5,6 +5,7 @@
 #include "eps_file.h"
 #include "line_renderer.h"
 #include "spring_renderer.h"
+#include "benchmarks.h"
 
 using namespace octet;
 
@@ -13,6 +14,8 @@ class LSystemApp : public app {
     ref<visual_scene> app_scene;
     ref<material> default_mtl;
     ref<QuickMesh> mesh;
+    // node of the mesh, carries the offset and scale of quantized positions
+    ref<scene_node> mesh_node;
     
     LineRenderer *line_renderer;
     SpringRenderer *spring_renderer;
@@ -36,6 +39,14 @@ class LSystemApp : public app {
     
     std::map <std::string, float*> config;
     
+    // view dependent level of detail, parts smaller than lod_pixels on screen are drawn as one segment
+    bool lod = false;
+    float lod_pixels = 1;
+    // size of a pixel in world units, set by transform()
+    float units_per_pixel = 0;
+    // center of the view in world units, set by transform()
+    vec3 view_center = vec3(0, 0, 0);
+    
 public:
     LSystemApp(int argc, char **argv) : app(argc, argv) {
     }
@@ -45,6 +56,15 @@ public:
         delete spring_renderer;
     }
     
+    /// Renders the l-system with the current renderer, commands are dispatched statically
+    void render_lsystem()
+    {
+        if( renderer == line_renderer )
+            G.render(line_renderer);
+        else
+            G.render(spring_renderer);
+    }
+    
     void parse_config()
     {
         printf("Parsing configuration %s\n",config_files[cur_config].c_str());
@@ -75,7 +95,7 @@ public:
             }
         }
         
-        G.render(renderer);
+        render_lsystem();
         mesh->calc_aabb();
     }
     
@@ -94,20 +114,38 @@ public:
         {
             renderer->delta = G.default_params["delta"];
         }
+        spring_renderer->seed = G.seed;
+        
+        // the previous l-system is gone once the file is parsed, so rather than keeping nothing
+        // the largest generation that fits in the budget is loaded
+        int n = n_iter;
+        while( n > 0 && !G.fits(G.estimate(n)) )
+            n--;
+        if( n < n_iter )
+        {
+            printf("Generation %d is over the memory budget of %g MB, loading generation %d\n", n_iter, G.memory_budget, n);
+            n_iter = n;
+        }
         
-        G.produce(n_iter);
-        G.render(renderer);
+        if( !G.produce(n_iter) )
+            return;
+        render_lsystem();
         mesh->calc_aabb();
     }
     
     /// this is called once OpenGL is initialized
     void app_init()
     {
-        // mesh shared by renderers
+        // derive large generations on all cores
+        G.pool = &ThreadPool::shared();
+        
+        // mesh shared by renderers, large ones are sent to GL over several frames
         mesh = new QuickMesh(GL_LINES);
+        mesh->upload_budget = 0.004;
         // renderers
         line_renderer = new LineRenderer(mesh);
         spring_renderer = new SpringRenderer(mesh);
+        spring_renderer->pool = &ThreadPool::shared();
         renderer = line_renderer;
         
         // add config entries,
@@ -119,6 +157,9 @@ public:
         config["speed"] = &spring_renderer->speed;
         config["t_mul"] = &spring_renderer->t_mul;
         config["dt"] = &spring_renderer->dt;
+        config["memory_budget"] = &G.memory_budget;
+        config["upload_budget"] = &mesh->upload_budget;
+        config["lod_pixels"] = &lod_pixels;
         
         // List all files in data dir.
         files = files_in_directory("./data");
@@ -140,7 +181,7 @@ public:
         mat4t mat;
         mat.loadIdentity();
         
-        app_scene->add_shape(mat, mesh, default_mtl, false);
+        mesh_node = app_scene->add_shape(mat, mesh, default_mtl, false)->get_node();
     }
     
     void keyboard()
@@ -221,14 +262,78 @@ public:
             if(is_key_going_up(i+48))
             {
                 printf("Producing with %d iterations\n", i);
+                if( !G.produce(i) )
+                    break;
                 n_iter = i;
-                G.produce(n_iter);
-                G.render(renderer);
+                render_lsystem();
                 mesh->calc_aabb();
                 break;
             }
         }
         
+        if(is_key_going_up('D'))
+        {
+            const char * modes[] = { "string", "streaming", "dag" };
+            // the mode only changes if the derivation fits in the budget
+            int previous = G.derivation;
+            G.derivation = (G.derivation+1)%3;
+            printf("Derivation mode: %s\n", modes[G.derivation]);
+            if( G.produce(n_iter) )
+            {
+                render_lsystem();
+                mesh->calc_aabb();
+            }
+            else
+            {
+                G.derivation = previous;
+                printf("Keeping derivation mode: %s\n", modes[G.derivation]);
+            }
+        }
+        
+        if(is_key_going_up('L'))
+        {
+            // level of detail works on the DAG, from the size of a pixel in the last frame.
+            // Nothing changes if the derivation doesn't fit in the budget
+            int previous_derivation = G.derivation;
+            float previous_size = G.lod_size;
+            G.lod_size = lod ? 0 : lod_pixels*units_per_pixel;
+            if( !lod )
+                G.derivation = Lsystem::DERIVE_DAG;
+            if( G.produce(n_iter) )
+            {
+                lod = !lod;
+                dirty = true;
+            }
+            else
+            {
+                G.derivation = previous_derivation;
+                G.lod_size = previous_size;
+            }
+            printf("Level of detail: %s\n", lod ? "on" : "off");
+        }
+        
+        if(is_key_going_up('V'))
+        {
+            line_renderer->cull = !line_renderer->cull;
+            line_renderer->view.clear();
+            line_renderer->branch_bounds.clear();
+            printf("View culling: %s\n", line_renderer->cull ? "on" : "off");
+            dirty = true;
+        }
+        
+        if(is_key_going_up('Q'))
+        {
+            bool quantize = mesh->get_format() != VertexPacker::FORMAT_XY_INT16;
+            mesh->set_format(quantize ? VertexPacker::FORMAT_XY_INT16 : VertexPacker::FORMAT_XY_FLOAT);
+            mesh->update();
+            printf("Vertex format: %s\n", quantize ? "16 bit quantized" : "float");
+        }
+        
+        if(is_key_going_up('M'))
+        {
+            run_benchmarks();
+        }
+        
         if(is_key_going_up('E')
            && renderer == spring_renderer)
         {
@@ -264,9 +369,37 @@ public:
         cam->get_node()->loadIdentity();
         cam->get_node()->translate(bb.get_center());
         cam->get_node()->scale(vec3(ratio*scale, ratio*scale, 1));
+        units_per_pixel = ratio*scale;
+        view_center = bb.get_center();
 
     }
 
+    /// Updates the region the line renderer draws, so branches out of view are skipped.
+    /// The region is twice the size of the screen, and is only moved when the screen leaves it
+    /// or after zooming in, so panning and zooming don't rebuild the mesh every frame
+    void cull_view( int w, int h )
+    {
+        if( units_per_pixel <= 0 )
+            return;
+        
+        float hw = 0.5f*w*units_per_pixel, hh = 0.5f*h*units_per_pixel;
+        Bounds screen;
+        screen.add(view_center.x() - hw, view_center.y() - hh, 0);
+        screen.add(view_center.x() + hw, view_center.y() + hh, 0);
+        
+        Bounds & view = line_renderer->view;
+        bool inside = !view.empty() && screen.lo[0] >= view.lo[0] && screen.hi[0] <= view.hi[0]
+                      && screen.lo[1] >= view.lo[1] && screen.hi[1] <= view.hi[1];
+        bool zoomed_in = inside && screen.hi[0] - screen.lo[0] < 0.25f*(view.hi[0] - view.lo[0]);
+        if( inside && !zoomed_in )
+            return;
+        
+        view.clear();
+        view.add(view_center.x() - 2*hw, view_center.y() - 2*hh, 0);
+        view.add(view_center.x() + 2*hw, view_center.y() + 2*hh, 0);
+        dirty = true;
+    }
+    
     /// this is called to draw the world
     void draw_world(int x, int y, int w, int h)
     {
@@ -282,15 +415,38 @@ public:
         //update();
         keyboard();
         
+        if( lod && G.active_derivation == Lsystem::DERIVE_DAG )
+        {
+            // rerendered when zooming changes the size of a pixel by more than a margin,
+            // so small changes of the box don't rerender every frame
+            float size = lod_pixels*units_per_pixel;
+            if( size > 0 && (G.lod_size == 0 || size*1.25f < G.lod_size || size > G.lod_size*1.25f) )
+            {
+                G.lod_size = size;
+                dirty = true;
+            }
+        }
+        
+        if( line_renderer->cull && renderer == line_renderer )
+            cull_view(vx, vy);
+        
         if(dirty)
         {
-            G.render(renderer);
+            render_lsystem();
             if(update_box_when_dirty)
                 mesh->calc_aabb();
         }
         
         dirty = false;
         
+        // send more of the mesh if it didn't fit in the last frames
+        mesh->continue_upload();
+        
+        // quantized positions are relative to the bounds of the mesh
+        mesh_node->loadIdentity();
+        mesh_node->translate(mesh->get_position_offset());
+        mesh_node->scale(mesh->get_position_scale());
+        
         //l_renderer.mesh->render();
         
         // update matrices. assume 30 fps.
@@ -1,21 +1,33 @@
 #pragma once
 
+#include "bounds.h"
+#include "turtle_2d.h"
+#include "turtle_kernel.h"
+#include "parallel_turtle.h"
+#include "angle_cache.h"
+#include "branch_bounds.h"
 
-class LineRenderer : public LsystemRenderer
+class LineRenderer final : public BatchRenderer<LineRenderer>
 {
 public:
     LineRenderer( QuickMesh * mesh )
     :
     mesh(mesh)
     {
-        stack.push_back(mat4t());
+        turtle.begin(delta, delta_offset);
     }
     
     void begin()
     {
         mesh->clear();
-        stack.clear();
-        stack.push_back(mat4t());
+        turtle.begin(delta, delta_offset);
+    }
+    
+    void reserve( const GrowthEstimate & estimate )
+    {
+        mesh->reserve(estimate.line_vertices());
+        moves = estimate.moves();
+        pushes = estimate.count('[');
     }
     
     void end()
@@ -31,48 +43,148 @@ public:
     
     void F()
     {
-        mesh->vertex(vec4(0,0,0,1)*mat()); // or optionally mat().w().xyz());
-        f();
-        mesh->vertex(vec4(0,0,0,1)*mat());// mat().w().xyz());
+        mesh->vertex(turtle.pos());
+        turtle.move(d);
+        mesh->vertex(turtle.pos());
     }
     
     void f()
     {
-        // octet vectors are rows
-        mat() = mat4t().translate(0, d, 0) * mat();
+        turtle.move(d);
+    }
+    
+    void F_run( int n )
+    {
+        if( !merge_segments )
+        {
+            LsystemRenderer::F_run(n);
+            return;
+        }
+        
+        // collinear segments are drawn as one
+        mesh->vertex(turtle.pos());
+        turtle.move(d*n);
+        mesh->vertex(turtle.pos());
+    }
+    
+    void f_run( int n )
+    {
+        turtle.move(d*n);
+    }
+    
+    /// A collapsed part of a DAG derivation, drawn as its chord
+    void shortcut( float x, float y, int n, bool draw )
+    {
+        if( draw )
+            mesh->vertex(turtle.pos());
+        turtle.jump(x, y, n);
+        if( draw )
+            mesh->vertex(turtle.pos());
+    }
+    
+    /// With a fixed angle programs are interpreted directly into the mesh, large ones on all threads of the pool
+    /// A program rendered again, e.g. while the angle is adjusted, is kept in an angle independent form
+    bool run_program( const TurtleProgram & program, ThreadPool * pool )
+    {
+        if( !batch )
+            return false;
+        if( cull && !turtle.randomized() )
+        {
+            // the hierarchy is only built if it fits in what the derivation, the mesh and the angle cache
+            // leave of the memory budget
+            if( BranchBounds::bytes(pushes) > cache_budget - angle_cache.memory() )
+                branch_bounds.clear();
+            else if( !branch_bounds.matches(program, delta, delta_offset, d) )
+                branch_bounds.build(program, turtle, delta, delta_offset, d);
+            // without branches there is nothing to skip
+            if( branch_bounds.usable() && !branch_bounds.empty() )
+            {
+                branch_bounds.run(program, this, view);
+                // the mesh keeps the bounds of the whole drawing, so fitting the camera to it doesn't depend on the view
+                mesh->add_bounds(branch_bounds.bounds, 0);
+                return true;
+            }
+        }
+        if( pool && (pool->size() < 2 || program.code.size() < min_parallel_size) )
+            pool = 0;
+        
+        bool rerender = program.revision == rendered_revision;
+        rendered_revision = program.revision;
+        if( cache_angles && rerender )
+        {
+            // the cache is only built if it fits in what the derivation, the mesh and the branch bounds
+            // leave of the memory budget, it is freed if it doesn't
+            double cache_bytes = cache_budget - branch_bounds.memory();
+            bool cached = angle_cache.matches(program, delta, d, merge_segments);
+            if( !cached && AngleCache::bytes(moves) <= cache_bytes )
+                cached = angle_cache.build(program, delta, d, merge_segments, cache_bytes);
+            else if( !cached )
+                angle_cache.clear();
+            if( cached )
+            {
+                angle_cache.evaluate(delta_offset, mesh->add_vertices(angle_cache.vertices()), pool);
+                mesh->add_bounds(angle_cache.bounds, angle_cache.vertices());
+                return true;
+            }
+        }
+        
+        if( !parallel.scan(program, turtle, d, merge_segments, pool) )
+            return false;
+        parallel.emit(mesh->add_vertices(parallel.vertices), pool);
+        mesh->add_bounds(parallel.bounds, parallel.vertices);
+        turtle.stack = parallel.end_stack;
+        return true;
+    }
+    
+    void rotate( int n )
+    {
+        turtle.rotate(n);
     }
     
     void plus()
     {
-        mat() = mat4t().rotateZ(+(delta+delta_offset)) * mat();
+        turtle.rotate(1);
     }
     
     void minus()
     {
-        mat() = mat4t().rotateZ(-(delta+delta_offset)) * mat();
+        turtle.rotate(-1);
     }
     
     void push()
     {
-        stack.push_back(stack.back());
+        turtle.push();
     }
     
     void pop()
     {
-        if(stack.size() < 2)
-        {
+        if(!turtle.pop())
             printf("Error, stack underflow!\n");
-            return;
-        }
-        
-        stack.pop_back();
     }
     
-    mat4t & mat() { return stack.back(); }
-    const mat4t & mat() const { return stack.back(); }
-    
     QuickMesh* mesh;
     
-    std::vector< mat4t > stack;
+    // draw runs of F as a single segment
+    bool merge_segments = true;
+    
+    Turtle2d turtle;
+    
+    // interpret programs directly rather than command by command
+    bool batch = true;
+    // programs with fewer instructions are interpreted on a single thread
+    size_t min_parallel_size = 1<<16;
+    ParallelTurtle parallel;
+    
+    // keep programs that are rendered more than once in an angle independent form
+    bool cache_angles = true;
+    AngleCache angle_cache;
+    unsigned rendered_revision = 0;
+    // predicted moves and pushes of the program, from reserve()
+    double moves = 0;
+    double pushes = 0;
+    
+    // with a fixed angle, only draw the branches of a program with a box intersecting view
+    bool cull = false;
+    Bounds view;
+    BranchBounds branch_bounds;
 };
-
@@ -0,0 +1,85 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Connected runs of line segments given as vertex pairs (GL_LINES order).
+/// A segment starting exactly where the previous one ended continues its run and reuses its
+/// vertex, so the interior points of paths such as Koch or Hilbert curves, or of spring
+/// polylines, are stored once. The segments are then drawn as indexed lines over the shared points
+/// (GLES2 has no primitive restart for line strips).
+/// Pairs are processed left to right, so appending pairs extends the runs without changing earlier ones.
+class LineRuns
+{
+public:
+    void clear()
+    {
+        points.clear();
+        indices.clear();
+        runs = 0;
+        pairs = 0;
+    }
+
+    /// Adds the segments of vertex pairs [pairs, n), as given by v
+    void add( const vec3p * v, size_t n )
+    {
+        n &= ~(size_t)1;
+        if( n <= pairs )
+            return;
+
+        // at most two points and indices per pair, trimmed afterwards
+        size_t n_points = points.size(), n_indices = indices.size();
+        points.resize(n_points + (n - pairs));
+        indices.resize(n_indices + (n - pairs));
+        vec3p * p = &points[0];
+        uint32_t * idx = &indices[0];
+        for( size_t i = pairs; i < n; i += 2 )
+        {
+            const vec3p & a = v[i];
+            if( n_points == 0 || !same(p[n_points-1], a) )
+            {
+                p[n_points++] = a;
+                runs++;
+            }
+            idx[n_indices++] = n_points - 1;
+            p[n_points++] = v[i+1];
+            idx[n_indices++] = n_points - 1;
+        }
+        points.resize(n_points);
+        pairs = n;
+    }
+
+    /// Bytes of the index type needed for the points, 2 or 4
+    size_t index_bytes() const { return points.size() <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t); }
+
+    /// Bytes of the runs as indexed lines, and as plain vertex pairs, for a vertex stride
+    size_t indexed_bytes( size_t stride ) const { return points.size()*stride + indices.size()*index_bytes(); }
+    size_t pair_bytes( size_t stride ) const { return pairs*stride; }
+
+    /// Writes indices [first, first+n) to dst, with index_bytes() each
+    void write_indices( size_t first, size_t n, uint8_t * dst ) const
+    {
+        if( index_bytes() == sizeof(uint16_t) )
+        {
+            uint16_t * out = (uint16_t*)dst;
+            for( size_t i = first; i < first + n; i++ )
+                *out++ = (uint16_t)indices[i];
+        }
+        else if( n )
+        {
+            memcpy(dst, &indices[first], n*sizeof(uint32_t));
+        }
+    }
+
+    // distinct points, in the order of the runs
+    std::vector<vec3p> points;
+    // two per segment, into points
+    std::vector<uint32_t> indices;
+    size_t runs = 0;
+    // vertices of the pairs added so far
+    size_t pairs = 0;
+
+private:
+    static bool same( const vec3p & a, const vec3p & b )
+    {
+        return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Tree of turtle positions in structure of arrays form: flat coordinates, the index of each node's
+/// parent, and the children of all nodes in one array, node i having children[child_begin[i], child_begin[i+1]).
+/// Node 0 is the root. Nodes are added in the order the turtle reaches them, which is depth first since a
+/// branch is finished before the turtle gets back to where it started, so the nodes of a subtree are
+/// contiguous and a parent always comes before its children.
+/// The arrays keep their storage when cleared, so rendering again doesn't allocate.
+class NodePool
+{
+public:
+    enum
+    {
+        NONE = 0xffffffff
+    };
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        parent.clear();
+        child_begin.clear();
+        children.clear();
+    }
+
+    void reserve( size_t n )
+    {
+        x.reserve(n);
+        y.reserve(n);
+        parent.reserve(n);
+    }
+
+    /// Adds a node, with parent NONE for the root. Returns its index
+    uint32_t add( const vec3 & pos, uint32_t p )
+    {
+        x.push_back(pos.x());
+        y.push_back(pos.y());
+        parent.push_back(p);
+        return x.size()-1;
+    }
+
+    /// Builds the child ranges once all nodes are added, children are in the order they were added
+    void link()
+    {
+        size_t n = size();
+        child_begin.assign(n+1, 0);
+        for( size_t i = 1; i < n; i++ )
+            child_begin[parent[i]+1]++;
+        for( size_t i = 0; i < n; i++ )
+            child_begin[i+1] += child_begin[i];
+
+        children.resize(n ? n-1 : 0);
+        // parents come first, so the children of each node are placed in increasing order
+        std::vector<uint32_t> & next = scratch;
+        next.assign(child_begin.begin(), child_begin.end()-1);
+        for( size_t i = 1; i < n; i++ )
+            children[next[parent[i]]++] = i;
+    }
+
+    size_t size() const { return x.size(); }
+
+    vec3 pos( uint32_t i ) const { return vec3(x[i], y[i], 0); }
+
+    uint32_t child_count( uint32_t i ) const { return child_begin[i+1] - child_begin[i]; }
+    uint32_t child( uint32_t i, uint32_t j ) const { return children[child_begin[i] + j]; }
+
+    std::vector<float> x, y;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> child_begin;
+    std::vector<uint32_t> children;
+
+private:
+    std::vector<uint32_t> scratch;
+};
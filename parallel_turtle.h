@@ -0,0 +1,239 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Parallel interpretation of a turtle program with a fixed angle.
+/// Turtle commands are rigid transforms of the plane, which compose associatively, so:
+/// - the program is split into chunks, and each chunk is walked on its own thread from the origin.
+///   Its effect is summarized as the number of states it pops from below its start (unmatched ']'),
+///   followed by the transforms of the states it leaves on the stack (unmatched '[' and the final state),
+///   together with the number of vertices it emits.
+/// - a scan over the chunk summaries gives the stack each chunk starts with,
+///   and the offset of its vertices in the output.
+/// - each chunk is walked again from its start stack, writing its vertices to the range it owns.
+/// Chunks start at instruction boundaries where the command changes, so runs are merged as in TurtleProgram::run
+/// and the output is the same as interpreting the program serially, up to rounding.
+/// Without a thread pool the chunks are walked in turn. Either way commands between brackets are
+/// interpreted by TurtleKernel, without going through the renderer.
+class ParallelTurtle
+{
+public:
+    /// First pass, returns false if the program can't be interpreted in parallel
+    /// (extension symbols, randomized angles, or a stack underflow)
+    bool scan( const TurtleProgram & program, const Turtle2d & turtle, float d, bool merge_segments, ThreadPool * pool )
+    {
+        if( !program.extensions.empty() || turtle.randomized() )
+            return false;
+
+        this->program = &program;
+        this->turtle = turtle;
+        this->d = d;
+        this->merge_segments = merge_segments;
+
+        split(program.code, pool ? pool->size()*chunks_per_thread : 1);
+
+        if( chunks.size() == 1 )
+        {
+            // a single chunk starts from the turtle stack, we only need to know its vertex count
+            Chunk & chunk = chunks[0];
+            if( !count(chunk, turtle.stack.size()) )
+                return false;
+            chunk.offset = 0;
+            chunk.entry = turtle.stack;
+            vertices = chunk.vertices;
+            return true;
+        }
+
+        for_each_chunk(pool, [&]( int c ) {
+            Chunk & chunk = chunks[c];
+            Turtle2d t = this->turtle;
+            t.stack.assign(1, t.origin());
+            chunk.pops = 0;
+            chunk.vertices = walk(chunk, t, 0, &chunk.pops);
+            chunk.states = t.stack;
+        });
+
+        // the stack at the start of each chunk, only the entries it can pop are kept
+        std::vector<Turtle2d::State> stack = turtle.stack;
+        vertices = 0;
+        for( size_t c = 0; c < chunks.size(); c++ )
+        {
+            Chunk & chunk = chunks[c];
+            if( chunk.pops >= (int)stack.size() )
+                return false;
+
+            chunk.offset = vertices;
+            vertices += chunk.vertices;
+
+            chunk.entry.assign(stack.end() - (chunk.pops+1), stack.end());
+            stack.resize(stack.size() - chunk.pops);
+            Turtle2d::State base = stack.back();
+            stack.pop_back();
+            for( size_t i = 0; i < chunk.states.size(); i++ )
+                stack.push_back(turtle.transform(base, chunk.states[i]));
+        }
+        end_stack = stack;
+        return true;
+    }
+
+    /// Second pass, writes the vertices found by scan() to out, and their bounds to bounds
+    void emit( vec3p * out, ThreadPool * pool )
+    {
+        for_each_chunk(pool, [&]( int c ) {
+            Chunk & chunk = chunks[c];
+            Turtle2d t = turtle;
+            t.stack = chunk.entry;
+            int pops = 0;
+            walk(chunk, t, out + chunk.offset, &pops);
+            if( chunks.size() == 1 )
+                end_stack = t.stack;
+            // bounds of the vertices just written, merged below
+            chunk.bounds.clear();
+            chunk.bounds.add(out + chunk.offset, chunk.vertices);
+        });
+
+        bounds.clear();
+        for( size_t c = 0; c < chunks.size(); c++ )
+            bounds.add(chunks[c].bounds);
+    }
+
+    /// Number of vertices found by scan()
+    size_t vertices = 0;
+    /// Turtle stack at the end of the program
+    std::vector<Turtle2d::State> end_stack;
+    /// Bounds of the vertices written by emit()
+    Bounds bounds;
+
+    int chunks_per_thread = 4;
+    size_t min_chunk_size = 1<<14;
+
+private:
+    struct Chunk
+    {
+        size_t begin, end;  // range of instructions
+        int pops;           // states popped from below the start
+        std::vector<Turtle2d::State> states; // states left on the stack, relative to the origin
+        size_t vertices;
+        size_t offset;
+        std::vector<Turtle2d::State> entry;  // stack at the start
+        Bounds bounds;      // of the vertices written
+    };
+
+    void for_each_chunk( ThreadPool * pool, const std::function<void(int)> & fn )
+    {
+        if( pool )
+        {
+            pool->parallel_for(chunks.size(), fn);
+            return;
+        }
+        for( size_t c = 0; c < chunks.size(); c++ )
+            fn(c);
+    }
+
+    void split( const std::vector<uint8_t> & code, int n_chunks )
+    {
+        size_t n = code.size();
+        n_chunks = std::max(1, std::min(n_chunks, (int)(n/min_chunk_size)));
+
+        chunks.resize(n_chunks);
+        size_t prev = 0;
+        for( int c = 0; c < n_chunks; c++ )
+        {
+            size_t b = std::max(prev, (size_t)c*n/n_chunks);
+            // don't split a run of movements or rotations
+            while( b > 0 && b < n && TurtleProgram::opcode(code[b]) <= TurtleProgram::OP_MINUS
+                  && TurtleProgram::opcode(code[b]) == TurtleProgram::opcode(code[b-1]) )
+                b++;
+            chunks[c].begin = b;
+            if( c )
+                chunks[c-1].end = b;
+            prev = b;
+        }
+        chunks.back().end = n;
+    }
+
+    /// Counts the vertices of a chunk without moving the turtle, starting with a stack of a given size.
+    /// Returns false on stack underflow
+    bool count( Chunk & chunk, size_t stack_size ) const
+    {
+        const std::vector<uint8_t> & code = program->code;
+        chunk.vertices = 0;
+        int prev = TurtleProgram::OP_NONE;
+        for( size_t i = chunk.begin; i < chunk.end; i++ )
+        {
+            int op = TurtleProgram::opcode(code[i]);
+            int n = TurtleProgram::count(code[i]);
+            if( op == TurtleProgram::OP_F )
+            {
+                // consecutive F instructions are drawn as one segment when merged
+                if( !merge_segments )
+                    chunk.vertices += 2*n;
+                else if( prev != TurtleProgram::OP_F )
+                    chunk.vertices += 2;
+            }
+            else if( op == TurtleProgram::OP_PUSH )
+            {
+                stack_size += n;
+            }
+            else if( op == TurtleProgram::OP_POP )
+            {
+                if( stack_size <= (size_t)n )
+                    return false;
+                stack_size -= n;
+            }
+            prev = op;
+        }
+        return true;
+    }
+
+    /// Walks the instructions of a chunk, writing vertices to out if given.
+    /// Pops below the bottom of the stack restart from the origin and are counted in pops.
+    size_t walk( const Chunk & chunk, Turtle2d & t, vec3p * out, int * pops ) const
+    {
+        TurtleKernel kernel(t, d, merge_segments);
+        
+        const std::vector<uint8_t> & code = program->code;
+        size_t n_vertices = 0;
+        size_t i = chunk.begin;
+        while( i < chunk.end )
+        {
+            uint8_t ins = code[i];
+            int op = TurtleProgram::opcode(ins);
+            int n = TurtleProgram::count(ins);
+            if( op == TurtleProgram::OP_PUSH )
+            {
+                for( int j = 0; j < n; j++ )
+                    t.push();
+                i++;
+                continue;
+            }
+            if( op == TurtleProgram::OP_POP )
+            {
+                for( int j = 0; j < n; j++ )
+                {
+                    if( !t.pop() )
+                    {
+                        (*pops)++;
+                        t.top() = t.origin();
+                    }
+                }
+                i++;
+                continue;
+            }
+
+            // run of commands up to the next bracket
+            size_t end = i+1;
+            while( end < chunk.end && TurtleProgram::opcode(code[end]) != TurtleProgram::OP_PUSH
+                  && TurtleProgram::opcode(code[end]) != TurtleProgram::OP_POP )
+                end++;
+            n_vertices += kernel.run(&code[0], i, end, t.top(), out ? out + n_vertices : 0);
+            i = end;
+        }
+        return n_vertices;
+    }
+
+    const TurtleProgram * program = 0;
+    Turtle2d turtle;
+    float d = 1;
+    bool merge_segments = true;
+    std::vector<Chunk> chunks;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Peephole optimizer for turtle programs.
+/// - runs of F, f, + and - are merged across instruction boundaries
+/// - with fold_rotations, mixed runs of + and - are folded to their net rotation (+-+ -> +)
+/// - branches that do not draw anything ([], [+], [[-]+]) are removed,
+///   as well as rotations right before the end of a branch
+/// Rotations are only folded, and branches with rotations only removed, if fold_rotations is set,
+/// since with a randomized angle each rotation draws a different value.
+class PeepholeOptimizer
+{
+public:
+    void optimize( const TurtleProgram & src, TurtleProgram & dst, bool fold_rotations )
+    {
+        ops.clear();
+        branches.clear();
+
+        const std::vector<uint8_t> & code = src.code;
+        for( size_t i = 0; i < code.size(); i++ )
+        {
+            uint8_t ins = code[i];
+            int op = TurtleProgram::opcode(ins);
+            switch( op )
+            {
+                case TurtleProgram::OP_F:
+                case TurtleProgram::OP_f:
+                    add(op, TurtleProgram::count(ins));
+                    draw();
+                    break;
+                case TurtleProgram::OP_PLUS:
+                    rotate(TurtleProgram::count(ins), fold_rotations);
+                    break;
+                case TurtleProgram::OP_MINUS:
+                    rotate(-TurtleProgram::count(ins), fold_rotations);
+                    break;
+                case TurtleProgram::OP_PUSH:
+                    for( int j = 0; j < TurtleProgram::count(ins); j++ )
+                        push();
+                    break;
+                case TurtleProgram::OP_POP:
+                    for( int j = 0; j < TurtleProgram::count(ins); j++ )
+                        pop(fold_rotations);
+                    break;
+                default:
+                    add(op, TurtleProgram::extension(ins));
+                    draw();
+                    break;
+            }
+        }
+
+        // same for a rotation at the very end
+        if( fold_rotations && !ops.empty() && ops.back().op == TurtleProgram::OP_PLUS )
+            ops.pop_back();
+
+        encode(dst);
+        dst.extensions = src.extensions;
+        memcpy(dst.symbols, src.symbols, sizeof(src.symbols));
+    }
+
+private:
+    struct Op
+    {
+        int op;
+        int n; // count, signed net count for rotations, extension index for OP_EXT
+    };
+
+    struct Branch
+    {
+        size_t begin;   // index of the push op
+        bool draws;
+        bool rotates;
+    };
+
+    void add( int op, int n )
+    {
+        // merge with the previous op if it is the same builtin command
+        if( op <= TurtleProgram::OP_f && !ops.empty() && ops.back().op == op )
+        {
+            ops.back().n += n;
+            return;
+        }
+        Op o = { op, n };
+        ops.push_back(o);
+    }
+
+    void draw()
+    {
+        if( !branches.empty() )
+            branches.back().draws = true;
+    }
+
+    void rotate( int n, bool fold )
+    {
+        if( !branches.empty() )
+            branches.back().rotates = true;
+
+        if( !ops.empty() && ops.back().op == TurtleProgram::OP_PLUS )
+        {
+            Op & last = ops.back();
+            // without folding only rotations in the same direction are merged
+            if( fold || (last.n > 0) == (n > 0) )
+            {
+                last.n += n;
+                if( last.n == 0 )
+                    ops.pop_back();
+                return;
+            }
+        }
+        Op o = { TurtleProgram::OP_PLUS, n };
+        ops.push_back(o);
+    }
+
+    void push()
+    {
+        Branch b = { ops.size(), false, false };
+        branches.push_back(b);
+        Op o = { TurtleProgram::OP_PUSH, 1 };
+        ops.push_back(o);
+    }
+
+    void pop( bool fold )
+    {
+        if( branches.empty() )
+        {
+            // unmatched, leave it to the renderer
+            Op o = { TurtleProgram::OP_POP, 1 };
+            ops.push_back(o);
+            return;
+        }
+
+        Branch b = branches.back();
+        branches.pop_back();
+
+        // a rotation just before the state is restored has no effect
+        if( fold && ops.size() > b.begin+1 && ops.back().op == TurtleProgram::OP_PLUS )
+            ops.pop_back();
+
+        if( !b.draws && (fold || !b.rotates) )
+        {
+            // nothing visible happens in the branch and the state is restored after it
+            ops.resize(b.begin);
+            return;
+        }
+
+        Op o = { TurtleProgram::OP_POP, 1 };
+        ops.push_back(o);
+
+        if( !branches.empty() )
+        {
+            branches.back().draws |= b.draws;
+            branches.back().rotates |= b.rotates;
+        }
+    }
+
+    /// Encodes ops to instructions, splitting long runs
+    void encode( TurtleProgram & dst )
+    {
+        dst.clear();
+        for( size_t i = 0; i < ops.size(); i++ )
+        {
+            Op o = ops[i];
+            if( o.op == TurtleProgram::OP_EXT )
+            {
+                dst.code.push_back(TurtleProgram::instruction(o.op, o.n));
+                continue;
+            }
+
+            if( o.op == TurtleProgram::OP_PLUS && o.n < 0 )
+            {
+                o.op = TurtleProgram::OP_MINUS;
+                o.n = -o.n;
+            }
+
+            // consecutive pushes and pops are merged here
+            while( (o.op == TurtleProgram::OP_PUSH || o.op == TurtleProgram::OP_POP)
+                  && i+1 < ops.size() && ops[i+1].op == o.op )
+            {
+                o.n++;
+                i++;
+            }
+
+            while( o.n > 0 )
+            {
+                int n = std::min(o.n, (int)TurtleProgram::MAX_COUNT);
+                dst.code.push_back(TurtleProgram::instruction(o.op, n-1));
+                o.n -= n;
+            }
+        }
+    }
+
+    std::vector<Op> ops;
+    std::vector<Branch> branches;
+};
@@ -0,0 +1,227 @@
+#pragma once
+#include "thread_pool.h"
+#include "counter_rng.h"
+#include "alias_table.h"
+
+///////////////////////////////////////////////////////
+/// Production rule for a given predecessor a
+/// Multiple successors can be specified with weights determining the likelyhood of being samples.
+struct Production
+{
+	char a;
+
+    std::vector<float> weights;
+	std::vector<std::string> successors;
+    
+    // alias table over weights, must be rebuilt when weights change
+    AliasTable sampler;
+
+    void build_sampler()
+    {
+        sampler.build(weights);
+    }
+
+    /// Index of a successor, sampled according to weights given a uniform random 32 bit word
+    int choose( uint32_t r ) const
+    {
+        if( successors.size() < 2 )
+            return 0;
+        return sampler.sample(r);
+    }
+
+	std::string successor( uint32_t r )
+	{
+		// return same in case
+		if( successors.size() < 1 )
+		{
+			return std::string(1,a);
+		}
+
+        return successors[choose(r)];
+	}
+};
+
+
+///////////////////////////////////////////////////////
+/// Dense lookup table of productions indexed by symbol,
+/// used to rewrite a whole generation at once.
+/// A rewrite step is done in two passes, first we compute the length of each successor,
+/// then we write all successors into an output buffer allocated to the exact size.
+class ProductionTable
+{
+public:
+    enum
+    {
+        RULE_SKIP = 0,      // whitespace etc, dropped from output
+        RULE_IDENTITY,      // no production, symbol is copied
+        RULE_DETERMINISTIC, // single successor
+        RULE_STOCHASTIC     // multiple weighted successors
+    };
+
+    struct Rule
+    {
+        int type = RULE_SKIP;
+        const Production * production = 0;
+        // successor for deterministic productions
+        const char * str = 0;
+        size_t len = 0;
+    };
+
+    /// Builds the table from a set of productions.
+    /// The productions must not change while the table is in use.
+    void build( const std::map<char, Production> & P )
+    {
+        stochastic = false;
+        for( int i = 0; i < 256; i++ )
+        {
+            Rule & r = rules[i];
+            r = Rule();
+            if( isalnum(i) || ispunct(i) )
+            {
+                r.type = RULE_IDENTITY;
+                r.len = 1;
+            }
+        }
+
+        for( std::map<char, Production>::const_iterator it = P.begin(); it != P.end(); ++it )
+        {
+            Rule & r = rule(it->first);
+            const Production & p = it->second;
+            if( r.type == RULE_SKIP || p.successors.size() < 1 )
+                continue;
+
+            r.production = &p;
+            if( p.successors.size() == 1 )
+            {
+                r.type = RULE_DETERMINISTIC;
+                r.str = p.successors[0].c_str();
+                r.len = p.successors[0].length();
+            }
+            else
+            {
+                r.type = RULE_STOCHASTIC;
+                stochastic = true;
+            }
+        }
+    }
+
+    Rule & rule( char a ) { return rules[(unsigned char)a]; }
+    const Rule & rule( char a ) const { return rules[(unsigned char)a]; }
+
+    /// Rewrites n symbols of src (the given generation) into dst, dst is resized to fit the result exactly.
+    /// Stochastic successors are sampled with a counter based generator keyed on (seed, generation, symbol index),
+    /// so the result only depends on the seed.
+    /// If a thread pool is given, large inputs are split into chunks that are rewritten in parallel:
+    /// successor lengths are counted per chunk, an exclusive scan of the counts gives the offset
+    /// of each chunk in the output, and each chunk then writes its successors in place.
+    /// src and dst must not overlap.
+    void rewrite( const char * src, size_t n, std::string & dst, unsigned generation=0, ThreadPool * pool=0 )
+    {
+        if( choices.size() < n )
+            choices.resize(n);
+
+        int n_chunks = 1;
+        if( pool && pool->size() > 1 )
+            n_chunks = std::min((size_t)pool->size()*chunks_per_thread, n/min_chunk_size);
+
+        if( n_chunks <= 1 )
+        {
+            dst.resize(length(src, 0, n, generation));
+            if( dst.length() )
+                write(src, 0, n, &dst[0]);
+            return;
+        }
+
+        std::vector<size_t> offsets(n_chunks+1, 0);
+        pool->parallel_for(n_chunks, [&]( int c ) {
+            offsets[c+1] = length(src, chunk_begin(c, n_chunks, n), chunk_begin(c+1, n_chunks, n), generation);
+        });
+
+        // exclusive scan
+        for( int c = 0; c < n_chunks; c++ )
+            offsets[c+1] += offsets[c];
+
+        dst.resize(offsets[n_chunks]);
+        if( !dst.length() )
+            return;
+
+        char * out = &dst[0];
+        pool->parallel_for(n_chunks, [&]( int c ) {
+            write(src, chunk_begin(c, n_chunks, n), chunk_begin(c+1, n_chunks, n), out + offsets[c]);
+        });
+    }
+
+    /// Successor index of a stochastic symbol at index i of a generation
+    int choose( const Rule & r, unsigned generation, uint64_t i ) const
+    {
+        return r.production->choose(counter_rng(seed, RNG_STREAM_PRODUCTION, generation, i));
+    }
+
+    /// Total length of the successors of symbols in [begin, end),
+    /// successors of stochastic symbols are sampled and stored for the write pass
+    size_t length( const char * src, size_t begin, size_t end, unsigned generation )
+    {
+        size_t len = 0;
+        for( size_t i = begin; i < end; i++ )
+        {
+            const Rule & r = rule(src[i]);
+            if( r.type == RULE_STOCHASTIC )
+            {
+                choices[i] = choose(r, generation, i);
+                len += r.production->successors[choices[i]].length();
+            }
+            else
+            {
+                len += r.len;
+            }
+        }
+        return len;
+    }
+
+    /// Writes the successors of symbols in [begin, end) to out
+    void write( const char * src, size_t begin, size_t end, char * out ) const
+    {
+        for( size_t i = begin; i < end; i++ )
+        {
+            const char a = src[i];
+            const Rule & r = rule(a);
+            switch( r.type )
+            {
+                case RULE_IDENTITY:
+                    *out++ = a;
+                    break;
+                case RULE_DETERMINISTIC:
+                    memcpy(out, r.str, r.len);
+                    out += r.len;
+                    break;
+                case RULE_STOCHASTIC:
+                {
+                    const std::string & s = r.production->successors[choices[i]];
+                    memcpy(out, s.c_str(), s.length());
+                    out += s.length();
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    static size_t chunk_begin( int c, int n_chunks, size_t n )
+    {
+        return (n / n_chunks) * c + std::min((size_t)c, n % n_chunks);
+    }
+
+    Rule rules[256];
+    bool stochastic = false;
+    
+    // seed for stochastic productions
+    uint64_t seed = 0;
+
+    // parallel rewriting granularity
+    size_t min_chunk_size = 1<<16;
+    size_t chunks_per_thread = 4;
+
+    // successor choices of stochastic symbols, reused across rewrites
+    std::vector<int> choices;
+};
@@ -1,65 +1,414 @@
 #pragma once
+
+#include "vertex_format.h"
+#include "line_runs.h"
+#include "bounds.h"
+#include "chunked_upload.h"
+
 namespace octet
 {
 namespace scene
 {
-    
+
 /// A mesh class for making prcedural geometry of various kinds.
+/// Points are kept on the CPU and packed to the GL buffer in a compact format (see VertexPacker).
+/// The GL buffer only grows, so updates reuse it, and a range of points can be updated on its own.
+/// Large meshes can be sent over several frames within a time budget (see ChunkedUpload).
+/// Bounds are tracked as points are added, so the bounding box doesn't need another pass over them.
+/// Connected lines share their points when that takes less memory (see LineRuns):
+/// a single run is drawn as a line strip, several as indexed lines.
 /// Note: breaks with bullet.
-    
+
 class QuickMesh : public mesh {
     dynarray<vec3p> verts;
-    
+    // bounds of the first bounded points
+    Bounds bounds;
+    size_t bounded = 0;
+
+    GLenum primitive;
+    VertexPacker packer;
+    // bytes allocated for the GL buffers, and points currently packed
+    size_t capacity = 0;
+    size_t index_capacity = 0;
+    size_t packed = 0;
+    std::vector<uint8_t> staging;
+    // shared points sent by a chunked upload
+    size_t sent_points = 0;
+
+    enum
+    {
+        LAYOUT_PAIRS = 0,   // points as given
+        LAYOUT_INDEXED,     // shared points, two indices per line
+        LAYOUT_STRIP        // shared points of a single run, drawn as a line strip
+    };
+
+    // shared points of line segments, unless drawn as pairs
+    LineRuns runs;
+    int layout = LAYOUT_PAIRS;
+
     void init( GLenum primitive ) {
-        set_default_attributes();
-        set_params(32, 0, 0, primitive, 0);
+        this->primitive = primitive;
+        set_format(VertexPacker::FORMAT_XY_FLOAT);
         //update();
     }
-    
+
 public:
 //    RESOURCE_META(QuickMesh)
-    
+
     /// make a new, empty mesh.
     QuickMesh(  GLenum primitive )
     {
         init(primitive);
     }
-    
+
+    /// Sets the layout of the GL buffer, one of the VertexPacker formats. Takes effect on the next update().
+    void set_format( int format )
+    {
+        packer.format = format;
+        packed = 0;
+
+        clear_attributes();
+        switch( format )
+        {
+            case VertexPacker::FORMAT_XY_FLOAT:
+                add_attribute(attribute_pos, 2, GL_FLOAT, 0);
+                break;
+            case VertexPacker::FORMAT_XY_INT16:
+                add_attribute(attribute_pos, 2, GL_SHORT, 0, 1);
+                break;
+            default:
+                set_default_attributes();
+                break;
+        }
+        set_params(packer.stride(), 0, 0, primitive, 0);
+    }
+
+    int get_format() const { return packer.format; }
+
+    /// Translation and scale to apply to the mesh node, so that quantized positions are drawn in place
+    vec3 get_position_offset() const { return packer.offset(); }
+    vec3 get_position_scale() const { return packer.scale(); }
+
     void clear()
     {
         verts.reset();
+        bounds.clear();
+        bounded = 0;
+    }
+
+    /// allocate storage for n points upfront.
+    void reserve( size_t n )
+    {
+        verts.reserve(n);
+    }
+
+    /// add n points to the mesh, returns them to be written.
+    /// Their bounds should be given with add_bounds() once written, or they are computed by calc_aabb().
+    vec3p * add_vertices( size_t n )
+    {
+        size_t size = verts.size();
+        verts.resize(size + n);
+        return n ? &verts[size] : 0;
+    }
+
+    /// Extends the bounds with those of the last n points added, as computed by their writer
+    void add_bounds( const Bounds & b, size_t n )
+    {
+        if( bounded + n != verts.size() )
+            return;
+        bounds.add(b);
+        bounded += n;
     }
 
     /// add a point to the mesh.
     void vertex(vec3_in pos)
     {
+        if( bounded == verts.size() )
+        {
+            bounds.add(pos.x(), pos.y(), pos.z());
+            bounded++;
+        }
         verts.push_back(pos);
     }
-    
+
+    size_t num_points() const { return verts.size(); }
+
     /// Build the OpenGL geometry.
+    /// With an upload budget, the geometry is only prepared here and sent in chunks by continue_upload(),
+    /// to be called once per frame. The part already sent is drawn meanwhile.
     void update()
     {
-        allocate(sizeof(mesh::vertex)*verts.size(), 0);
-        
-        gl_resource::wolock vtx_lock(get_vertices());
-        mesh::vertex *vtx = (mesh::vertex *)vtx_lock.u8();
-        
-        for (unsigned i = 0; i != verts.size(); ++i) {
-            vtx->pos = verts[i];
-            vtx->normal = vec3p(0, 0, 1);
-            vtx->uv = vec2(0, 0);
-            vtx++;
-        }
-        
-        set_num_indices(0);
-        set_num_vertices(verts.size());
-    }
-    
+        prepare();
+        packed = 0;
+        if( upload_budget > 0 )
+        {
+            upload.begin(upload_items());
+            set_drawn(0);
+            continue_upload();
+            return;
+        }
+
+        size_t n = verts.size();
+        if( layout != LAYOUT_PAIRS )
+        {
+            {
+                gl_resource::wolock vtx_lock(get_vertices());
+                packer.pack(&runs.points[0], runs.points.size(), vtx_lock.u8());
+            }
+            if( layout == LAYOUT_INDEXED )
+            {
+                gl_resource::wolock idx_lock(get_indices());
+                runs.write_indices(0, runs.indices.size(), idx_lock.u8());
+            }
+            set_shared_params();
+        }
+        else
+        {
+            if( n )
+            {
+                gl_resource::wolock vtx_lock(get_vertices());
+                packer.pack(&verts[0], n, vtx_lock.u8());
+            }
+            set_params(packer.stride(), 0, n, primitive, 0);
+        }
+        upload.begin(0);
+        packed = n;
+    }
+
+    /// Sends chunks of an upload started by update() for at most upload_budget seconds.
+    /// Returns true while chunks remain.
+    bool continue_upload()
+    {
+        if( upload.finished() )
+            return false;
+        upload.step(upload_budget, [&]( size_t first, size_t n ) {
+            send_chunk(first, n);
+        });
+        set_drawn(upload.done());
+        if( upload.finished() )
+            packed = verts.size();
+        return !upload.finished();
+    }
+
+    /// Updates points [first, first+n) of the OpenGL geometry, all points up to first must have been packed.
+    /// Falls back to a full update if the buffers must grow or quantized points leave the bounds.
+    /// Shared points can only be appended to (first equal to the number of points packed).
+    void update( size_t first, size_t n )
+    {
+        if( !upload.finished() )
+        {
+            update();
+            return;
+        }
+        if( layout != LAYOUT_PAIRS )
+        {
+            if( first != packed || !append_runs(first + n) )
+                update();
+            return;
+        }
+
+        size_t stride = packer.stride();
+        bool full = first > packed || (first + n)*stride > capacity;
+        for( size_t i = first; i < first + n && !full; i++ )
+            full = !packer.contains(verts[i]);
+        if( full )
+        {
+            update();
+            return;
+        }
+
+        if( n )
+        {
+            staging.resize(n*stride);
+            packer.pack(&verts[first], n, &staging[0]);
+            get_vertices()->assign(&staging[0], first*stride, n*stride);
+        }
+        packed = std::max(packed, first + n);
+        set_num_vertices(packed);
+    }
+
+    /// Bounds of the points, only points whose bounds were not tracked are visited
+    const Bounds & get_bounds()
+    {
+        if( bounded < verts.size() )
+        {
+            bounds.add(&verts[bounded], verts.size() - bounded);
+            bounded = verts.size();
+        }
+        return bounds;
+    }
+
+    /// Sets the bounding box of the mesh from the tracked bounds
+    aabb calc_aabb()
+    {
+        aabb bb = get_bounds().get_aabb();
+        set_aabb(bb);
+        return bb;
+    }
+
     /// Serialize.
     void visit(visitor &v) {
         mesh::visit(v);
         v.visit(verts, atom_point);
     }
+
+    // draw connected lines over shared points when it takes less memory
+    bool share_vertices = true;
+    // seconds per frame spent sending geometry, 0 to send it all in update()
+    float upload_budget = 0;
+    ChunkedUpload upload;
+
+private:
+    /// Chooses the layout for the points and makes room for them in the GL buffers
+    void prepare()
+    {
+        size_t n = verts.size();
+        if( packer.quantized() )
+        {
+            const Bounds & bb = get_bounds();
+            packer.set_bounds(bb.min(), bb.max());
+        }
+
+        size_t stride = packer.stride();
+        layout = LAYOUT_PAIRS;
+        if( share_vertices && primitive == GL_LINES )
+        {
+            runs.clear();
+            if( n )
+                runs.add(&verts[0], n);
+            if( runs.runs == 1 )
+                layout = LAYOUT_STRIP;
+            else if( runs.indexed_bytes(stride) < runs.pair_bytes(stride) )
+                layout = LAYOUT_INDEXED;
+        }
+
+        if( layout == LAYOUT_PAIRS )
+            reserve_buffers(n*stride, 0);
+        else
+            reserve_buffers(runs.points.size()*stride, layout == LAYOUT_INDEXED ? runs.indices.size()*runs.index_bytes() : 0);
+        sent_points = 0;
+    }
+
+    /// Items of the upload: vertices, shared points, or indices into them
+    size_t upload_items() const
+    {
+        switch( layout )
+        {
+            case LAYOUT_STRIP:
+                return runs.points.size();
+            case LAYOUT_INDEXED:
+                return runs.indices.size();
+            default:
+                return verts.size();
+        }
+    }
+
+    /// Packs and sends upload items [first, first+n)
+    void send_chunk( size_t first, size_t n )
+    {
+        size_t stride = packer.stride();
+        if( layout == LAYOUT_PAIRS || layout == LAYOUT_STRIP )
+        {
+            const vec3p * src = layout == LAYOUT_PAIRS ? &verts[first] : &runs.points[first];
+            staging.resize(n*stride);
+            packer.pack(src, n, &staging[0]);
+            get_vertices()->assign(&staging[0], first*stride, n*stride);
+            return;
+        }
+
+        // indices only refer to points up to the last one, since runs are in order
+        size_t points_needed = runs.indices[first + n - 1] + 1;
+        if( points_needed > sent_points )
+        {
+            size_t n_points = points_needed - sent_points;
+            staging.resize(n_points*stride);
+            packer.pack(&runs.points[sent_points], n_points, &staging[0]);
+            get_vertices()->assign(&staging[0], sent_points*stride, n_points*stride);
+            sent_points = points_needed;
+        }
+        size_t index_bytes = runs.index_bytes();
+        staging.resize(n*index_bytes);
+        runs.write_indices(first, n, &staging[0]);
+        get_indices()->assign(&staging[0], first*index_bytes, n*index_bytes);
+    }
+
+    /// Draws the first n upload items
+    void set_drawn( size_t n )
+    {
+        switch( layout )
+        {
+            case LAYOUT_STRIP:
+                set_params(packer.stride(), 0, n, GL_LINE_STRIP, 0);
+                break;
+            case LAYOUT_INDEXED:
+                set_params(packer.stride(), n & ~(size_t)1, sent_points, primitive,
+                           runs.index_bytes() == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+                break;
+            default:
+                // whole lines only
+                set_params(packer.stride(), 0, primitive == GL_LINES ? n & ~(size_t)1 : n, primitive, 0);
+                break;
+        }
+    }
+
+    void set_shared_params()
+    {
+        size_t n_points = runs.points.size();
+        if( layout == LAYOUT_STRIP )
+            set_params(packer.stride(), 0, n_points, GL_LINE_STRIP, 0);
+        else
+            set_params(packer.stride(), runs.indices.size(), n_points, primitive,
+                       runs.index_bytes() == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+    }
+
+    /// Grows the GL buffers to hold at least the given sizes in bytes, at least doubling them so they are rarely reallocated
+    void reserve_buffers( size_t size, size_t index_size )
+    {
+        if( size <= capacity && index_size <= index_capacity && capacity )
+            return;
+        capacity = std::max(std::max(size, 2*capacity), (size_t)1024);
+        if( index_size > index_capacity )
+            index_capacity = std::max(index_size, 2*index_capacity);
+        allocate(capacity, index_capacity);
+        packed = 0;
+    }
+
+    /// Extends shared points to the first n points, returns false if a full update is needed
+    bool append_runs( size_t n )
+    {
+        size_t stride = packer.stride();
+        size_t first_point = runs.points.size();
+        size_t first_index = runs.indices.size();
+        size_t old_index_bytes = runs.index_bytes();
+        runs.add(&verts[0], n);
+
+        size_t n_points = runs.points.size();
+        size_t n_indices = runs.indices.size();
+        if( layout == LAYOUT_STRIP && runs.runs > 1 )
+            return false;
+        if( (layout == LAYOUT_INDEXED && runs.index_bytes() != old_index_bytes) || n_points*stride > capacity
+           || (layout == LAYOUT_INDEXED && n_indices*old_index_bytes > index_capacity) )
+            return false;
+        for( size_t i = first_point; i < n_points; i++ )
+            if( !packer.contains(runs.points[i]) )
+                return false;
+
+        if( n_points > first_point )
+        {
+            staging.resize((n_points - first_point)*stride);
+            packer.pack(&runs.points[first_point], n_points - first_point, &staging[0]);
+            get_vertices()->assign(&staging[0], first_point*stride, staging.size());
+        }
+        if( layout == LAYOUT_INDEXED && n_indices > first_index )
+        {
+            staging.resize((n_indices - first_index)*old_index_bytes);
+            runs.write_indices(first_index, n_indices - first_index, &staging[0]);
+            get_indices()->assign(&staging[0], first_index*old_index_bytes, staging.size());
+        }
+        packed = runs.pairs;
+        set_shared_params();
+        return true;
+    }
 };
 
 }
@@ -0,0 +1,136 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Spring integration of several planar paths at once, in structure of arrays form.
+/// As in SpringRenderer::spring_path, the spring of each path follows an equilibrium point moving along
+/// a polyline. LANES paths are advanced together, the state of lane i being px[i], py[i], vx[i], vy[i],
+/// so the integration step is a loop over lanes that the compiler turns into vector instructions.
+/// All paths start at t = 0 and share their time steps, a path stops once its duration is reached,
+/// so paths of similar durations should be batched together. The number of steps of each path is known
+/// upfront, so outputs are sized once and written in place.
+/// Results are the same as integrating each path on its own.
+class SpringBatch
+{
+public:
+    enum
+    {
+        LANES = 8
+    };
+
+    /// Integrates n <= LANES paths: path i follows P[i] over t_end[i] seconds and runs for duration[i] seconds,
+    /// its spring positions are written to out[i]
+    void integrate( const polyline * const * P, const float * t_end, const float * duration, int n,
+                    float kp, float kv, float dt, polyline * const * out )
+    {
+        // shared time steps, up to the longest duration
+        float max_duration = 0;
+        for( int i = 0; i < n; i++ )
+            max_duration = std::max(max_duration, duration[i]);
+        times.clear();
+        for( float t = 0.0; t < max_duration; t += dt )
+            times.push_back(t);
+
+        // lane state, and the polyline of each path as its number of segments and its points
+        float px[LANES], py[LANES], vx[LANES], vy[LANES];
+        float te[LANES], param_len[LANES];
+        int nsegs[LANES];
+        const vec3 * points[LANES];
+        size_t steps[LANES];
+        vec3 * res[LANES];
+        // no reallocation, lanes point into it
+        singles.clear();
+        singles.reserve(2*LANES);
+        for( int i = 0; i < LANES; i++ )
+        {
+            px[i] = py[i] = vx[i] = vy[i] = 0;
+            te[i] = 1;
+            nsegs[i] = 1;
+            param_len[i] = 1;
+            points[i] = 0;
+            steps[i] = 0;
+            if( i >= n )
+                continue;
+
+            const polyline & Pi = *P[i];
+            px[i] = Pi[0].x();
+            py[i] = Pi[0].y();
+            te[i] = t_end[i];
+            points[i] = &Pi[0];
+            // a single point is a segment of length 0
+            nsegs[i] = std::max((int)Pi.size()-1, 1);
+            param_len[i] = 1.0 / nsegs[i];
+            if( Pi.size() < 2 )
+                points[i] = single(Pi[0]);
+            // the steps of a path are a prefix of the shared ones
+            steps[i] = std::lower_bound(times.begin(), times.end(), duration[i]) - times.begin();
+            out[i]->resize(steps[i]);
+            res[i] = steps[i] ? &(*out[i])[0] : 0;
+        }
+
+        for( size_t k = 0; k < times.size(); k++ )
+        {
+            float t = times[k];
+
+            // equilibrium points interpolated along the polylines, as interpolate_polyline()
+            int seg[LANES];
+            float w[LANES];
+            for( int i = 0; i < LANES; i++ )
+            {
+                float u = t/te[i];
+                int is = (int)(u*nsegs[i]);
+                is = is < nsegs[i]-1 ? is : nsegs[i]-1;
+                float l = (u - is*param_len[i]) / param_len[i];
+                // past the end, the last point
+                bool end = u > 1.0f;
+                seg[i] = end ? nsegs[i]-1 : is;
+                w[i] = end ? 1.0f : l;
+            }
+
+            float ax[LANES], ay[LANES], bx[LANES], by[LANES];
+            for( int i = 0; i < LANES; i++ )
+            {
+                const vec3 * p = points[i] ? points[i] + seg[i] : zero();
+                ax[i] = p[0].x(); ay[i] = p[0].y();
+                bx[i] = p[1].x(); by[i] = p[1].y();
+            }
+
+            for( int i = 0; i < LANES; i++ )
+            {
+                float w1 = 1.0f - w[i];
+                float ex = ax[i]*w1 + bx[i]*w[i];
+                float ey = ay[i]*w1 + by[i]*w[i];
+                float fx = -vx[i]*kv + (ex-px[i])*kp;
+                float fy = -vy[i]*kv + (ey-py[i])*kp;
+                vx[i] += fx*dt;
+                vy[i] += fy*dt;
+                px[i] += vx[i]*dt;
+                py[i] += vy[i]*dt;
+            }
+
+            for( int i = 0; i < n; i++ )
+            {
+                if( k < steps[i] )
+                    res[i][k] = vec3(px[i], py[i], 0);
+            }
+        }
+    }
+
+private:
+    /// Two points at the origin, for unused lanes
+    static const vec3 * zero()
+    {
+        static const vec3 p[2] = { vec3(0, 0, 0), vec3(0, 0, 0) };
+        return p;
+    }
+
+    /// A point repeated, as a segment of length 0
+    const vec3 * single( const vec3 & p )
+    {
+        singles.push_back(p);
+        singles.push_back(p);
+        return &singles[singles.size()-2];
+    }
+
+    std::vector<float> times;
+    std::vector<vec3> singles;
+};
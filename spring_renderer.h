@@ -1,6 +1,9 @@
 #pragma once
 
 #include "dp_simplify.h"
+#include "turtle_2d.h"
+#include "node_pool.h"
+#include "spring_batch.h"
 
 // Linearly interpolates between segments of a polyline t=[0,1]
 vec3 interpolate_polyline( const polyline & P, float t )
@@ -29,7 +32,7 @@ float polyline_length( const polyline & P )
     return l;
 }
 
-class SpringRenderer : public LsystemRenderer
+class SpringRenderer final : public BatchRenderer<SpringRenderer>
 {
 public:
     enum
@@ -41,84 +44,41 @@ public:
     
     SpringRenderer( QuickMesh * mesh )
     :
-    mesh(mesh),
-    tree(0)
+    mesh(mesh)
     {
     }
     
-    ~SpringRenderer()
+    /// Adds a node at the turtle position, as a child of the current one
+    uint32_t add_node()
     {
-        release();
-    }
-    
-    void release()
-    {
-        if(tree)
-            delete tree;
-        tree = 0;
-        for( int i = 0; i < nodes.size(); i++ )
-            delete nodes[i];
-        nodes.clear();
-    }
-    
-    struct Node
-    {
-        Node( const vec3 & pos=vec3(0,0,0) )
-        :
-        pos(pos)
-        {
-        }
-        
-        ~Node()
-        {
-            
-        }
-        
-        void add_child( Node * n )
-        {
-            children.push_back(n);
-            n->parent = this;
-        }
-        
-        vec3 pos;
-        std::vector<Node*> children;
-        Node * parent = 0;
-    };
-    
-    Node * add_node()
-    {
-        Node * n = new Node(pos());
-        nodes.push_back(n);
-        node_stack.back()->add_child(n);
+        uint32_t n = nodes.add(pos(), node_stack.back());
         node_stack.back() = n;
         return n;
     }
     
     void begin()
     {
-        release();
-        
-        tree = new Node();
+        // the root
+        nodes.clear();
+        nodes.add(vec3(0,0,0), NodePool::NONE);
         
         node_stack.clear();
-        node_stack.push_back(tree);
+        node_stack.push_back(0);
         
-        stack.clear();
-        stack.push_back(mat4t());
+        turtle.begin(delta, delta_offset);
         
         polylines.clear();
     }
     
-    polyline spring_path( const polyline & P, float speed, float kp=70, float kv=30, float dt=0.001, float t_mul=1.0 )
+    void reserve( const GrowthEstimate & estimate )
+    {
+        // a node for each move
+        nodes.reserve(estimate.moves()+1);
+    }
+    
+    /// Time the equilibrium point takes to move along P
+    float path_time( const polyline & P, float speed ) const
     {
-        vec3 v = vec3(0,0,0);
-        vec3 a = vec3(0,0,0);
-        vec3 f = vec3(0,0,0);
-
-        vec3 p = P[0];
-        
-        polyline res;
-        
         // local isochrony, each segment has a fixed duration independent
         float t_end = 0.0;
         switch(isochrony)
@@ -133,7 +93,20 @@ public:
                 t_end = 5.0 / speed;
                 break;
         }
+        return t_end;
+    }
+    
+    polyline spring_path( const polyline & P, float speed, float kp=70, float kv=30, float dt=0.001, float t_mul=1.0 )
+    {
+        vec3 v = vec3(0,0,0);
+        vec3 a = vec3(0,0,0);
+        vec3 f = vec3(0,0,0);
+
+        vec3 p = P[0];
+        
+        polyline res;
         
+        float t_end = path_time(P, speed);
         float duration = t_end * t_mul;
         
         float t = 0.0;
@@ -169,41 +142,141 @@ public:
     
     void end()
     {
-        // find leaf nodes
-        std::vector<Node*> leafs;
-        for( int i = 0; i < nodes.size(); i++ )
-        {
-            if( nodes[i]->children.size() == 0 )
-                leafs.push_back(nodes[i]);
-        }
-        
         mesh->clear();
         
         // set damping as a ratio of a critically damped system.
         // damping_ratio = 1 is critically damped
         float kv = damping_ratio * 2.0 * sqrt(kp);
-
-        for( int i = 0; i < leafs.size(); i++ )
+        
+        nodes.link();
+        simulate_leaves(kv);
+        mesh->update();
+    }
+    
+    /// Leaf nodes of the tree, in the order of their paths
+    std::vector<uint32_t> find_leafs() const
+    {
+        std::vector<uint32_t> leafs;
+        for( uint32_t i = 1; i < nodes.size(); i++ )
         {
-            Node * n = leafs[i];
-            polyline P;
-            while(n->parent != 0)
+            if( nodes.child_count(i) == 0 )
+                leafs.push_back(i);
+        }
+        return leafs;
+    }
+    
+    /// Equilibrium path of the i-th leaf: from the root, simplified, and with the trunk jitter of the path
+    polyline leaf_path( uint32_t leaf, uint64_t i ) const
+    {
+        uint32_t n = leaf;
+        polyline P;
+        while(nodes.parent[n] != NodePool::NONE)
+        {
+            
+            P.push_back(nodes.pos(n));
+            P.push_back(nodes.pos(nodes.parent[n]));
+            n = nodes.parent[n];
+        }
+        
+        // reverse because we begin from root
+        std::reverse(P.begin(),P.end());
+        P = dp_simplify(P, 0.1);
+        
+        P[0].x() += trunk_jitter(i);
+        //P[0].y() += (drand48()-0.5)*start_offset*2;
+        return P;
+    }
+    
+    /// Simulates the path from the root to each leaf on its own, a batch of paths at a time (see SpringBatch),
+    /// in parallel if a pool is set.
+    /// Paths from the root are not shared between leaves: each is simplified as a whole and its equilibrium point
+    /// is timed over its simplified segments, so the timing of a common prefix depends on the rest of each path
+    void simulate_leaves( float kv )
+    {
+        std::vector<uint32_t> leafs = find_leafs();
+        
+        // the equilibrium path of each leaf
+        size_t n_leafs = leafs.size();
+        std::vector<polyline> eq_paths(n_leafs);
+        std::vector<float> t_end(n_leafs), duration(n_leafs);
+        for_each(n_leafs, [&]( int i ) {
+            eq_paths[i] = leaf_path(leafs[i], i);
+            t_end[i] = path_time(eq_paths[i], speed);
+            duration[i] = t_end[i] * t_mul;
+        });
+        
+        // leafs are integrated in batches of similar durations, each into its own slot
+        std::vector<uint32_t> order(n_leafs);
+        for( uint32_t i = 0; i < n_leafs; i++ )
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&]( uint32_t a, uint32_t b ) {
+            return duration[a] < duration[b];
+        });
+        
+        const int lanes = SpringBatch::LANES;
+        std::vector<polyline> paths(n_leafs);
+        for_each((n_leafs + lanes-1)/lanes, [&]( int b ) {
+            const polyline * P[lanes];
+            polyline * out[lanes];
+            float batch_t_end[lanes], batch_duration[lanes];
+            int n = std::min((size_t)lanes, n_leafs - b*lanes);
+            for( int j = 0; j < n; j++ )
             {
-                
-                P.push_back(n->pos);
-                P.push_back(n->parent->pos);
-                n = n->parent;
+                uint32_t i = order[b*lanes + j];
+                P[j] = &eq_paths[i];
+                out[j] = &paths[i];
+                batch_t_end[j] = t_end[i];
+                batch_duration[j] = duration[i];
             }
-            
-            // reverse because we begin from root
-            std::reverse(P.begin(),P.end());
-            P = dp_simplify(P, 0.1);
-            
-            P[0].x() += (drand48()-0.5)*delta_trunk*2;
-            //P[0].y() += (drand48()-0.5)*start_offset*2;
-            add_polyline(spring_path(P, speed, kp, kv, dt, t_mul));
+            SpringBatch batch;
+            batch.integrate(P, batch_t_end, batch_duration, n, kp, kv, dt, out);
+        });
+        add_polylines(paths);
+    }
+    
+    /// Displacement of the start of the i-th path, a deterministic function of the seed and i
+    float trunk_jitter( uint64_t i ) const
+    {
+        return (counter_uniform(seed, RNG_STREAM_TRUNK, 0, i)-0.5)*delta_trunk*2;
+    }
+    
+    /// Calls fn(i) for i in [0, n), in parallel if a pool is set
+    void for_each( size_t n, const std::function<void(int)> & fn )
+    {
+        if( pool && pool->size() > 1 )
+        {
+            pool->parallel_for(n, fn);
+            return;
         }
-        mesh->update();
+        for( size_t i = 0; i < n; i++ )
+            fn(i);
+    }
+    
+    /// Moves the non empty paths to polylines and writes their segments to the mesh, in parallel
+    void add_polylines( std::vector<polyline> & paths )
+    {
+        std::vector<size_t> offsets;
+        size_t n_vertices = 0;
+        size_t first = polylines.size();
+        for( size_t i = 0; i < paths.size(); i++ )
+        {
+            if( paths[i].empty() )
+                continue;
+            offsets.push_back(n_vertices);
+            n_vertices += 2*(paths[i].size()-1);
+            polylines.push_back(std::move(paths[i]));
+        }
+        
+        vec3p * out = mesh->add_vertices(n_vertices);
+        for_each(offsets.size(), [&]( int j ) {
+            const polyline & P = polylines[first+j];
+            vec3p * v = out + offsets[j];
+            for( size_t i = 0; i+1 < P.size(); i++ )
+            {
+                *v++ = P[i];
+                *v++ = P[i+1];
+            }
+        });
     }
     
     void compute_aabb()
@@ -219,42 +292,63 @@ public:
     
     void f()
     {
-        mat() = mat4t().translate(0, d, 0) * mat();
+        turtle.move(d);
         add_node();
     }
     
+    // a node for each move, so runs are not merged
+    void F_run( int n )
+    {
+        f_run(n);
+    }
+    
+    void f_run( int n )
+    {
+        for( int i = 0; i < n; i++ )
+            f();
+    }
+    
+    /// A collapsed part of a DAG derivation becomes a single node
+    void shortcut( float x, float y, int n, bool draw )
+    {
+        turtle.jump(x, y, n);
+        if( x != 0 || y != 0 )
+            add_node();
+    }
+    
+    void rotate( int n )
+    {
+        turtle.rotate(n);
+    }
+    
     void plus()
     {
-        mat() = mat4t().rotateZ(+(delta+delta_offset)) * mat();
+        turtle.rotate(1);
     }
     
     void minus()
     {
-        mat() = mat4t().rotateZ(-(delta+delta_offset)) * mat();
+        turtle.rotate(-1);
     }
     
     void push()
     {
-        stack.push_back(stack.back());
+        turtle.push();
         node_stack.push_back(node_stack.back());
     }
     
     void pop()
     {
-        if(stack.size() < 2)
+        if(!turtle.pop())
         {
             printf("Error, stack underflow!\n");
             return;
         }
         
-        stack.pop_back();
         node_stack.pop_back();
     }
     
-    mat4t & mat() { return stack.back(); }
-    const mat4t & mat() const { return stack.back(); }
-    
-    vec3 pos() const { return mat().w().xyz(); }
+    vec3 pos() const { return turtle.pos(); }
     
     void render()
     {
@@ -274,8 +368,8 @@ public:
     QuickMesh* mesh;
     std::vector< polyline > polylines;
     
-    std::vector< mat4t > stack;
-    std::vector< Node* > node_stack;
+    Turtle2d turtle;
+    std::vector<uint32_t> node_stack;
     
     float kp=70.0;
     float m=0.1;
@@ -287,7 +381,12 @@ public:
     
     int isochrony=ISOCHRONY_NONE;
     
-    std::vector<Node*> nodes;
-    Node *tree=0;
+    // the turtle path as a tree, node 0 being the root
+    NodePool nodes;
+    
+    // paths are simulated on the threads of this pool if set
+    ThreadPool * pool = 0;
+    // seed of the trunk jitter of each path
+    uint64_t seed = 0;
 };
 
@@ -0,0 +1,205 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Headless stand-in for the parts of octet the mesh code uses, so packing, line runs and uploads
+/// can be tested on the CPU. GL buffers are byte arrays that count how many times each byte was written,
+/// and the draw parameters of a mesh are recorded so tests can read back what would be drawn.
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+typedef unsigned GLenum;
+
+#define GL_LINES 0x0001
+#define GL_LINE_STRIP 0x0003
+#define GL_SHORT 0x1402
+#define GL_UNSIGNED_SHORT 0x1403
+#define GL_UNSIGNED_INT 0x1405
+#define GL_FLOAT 0x1406
+
+namespace octet
+{
+    class vec3
+    {
+    public:
+        vec3( float x = 0, float y = 0, float z = 0 ) { v[0] = x; v[1] = y; v[2] = z; }
+
+        float & x() { return v[0]; }
+        float & y() { return v[1]; }
+        float & z() { return v[2]; }
+        float x() const { return v[0]; }
+        float y() const { return v[1]; }
+        float z() const { return v[2]; }
+        float & operator[]( int i ) { return v[i]; }
+        float operator[]( int i ) const { return v[i]; }
+
+        vec3 operator+( const vec3 & b ) const { return vec3(v[0]+b.v[0], v[1]+b.v[1], v[2]+b.v[2]); }
+        vec3 operator-( const vec3 & b ) const { return vec3(v[0]-b.v[0], v[1]-b.v[1], v[2]-b.v[2]); }
+        vec3 operator*( float s ) const { return vec3(v[0]*s, v[1]*s, v[2]*s); }
+
+    private:
+        float v[3];
+    };
+
+    typedef const vec3 & vec3_in;
+
+    /// Packed point, as stored by meshes
+    class vec3p
+    {
+    public:
+        vec3p() {}
+        vec3p( float x, float y, float z ) { v[0] = x; v[1] = y; v[2] = z; }
+        vec3p( const vec3 & p ) { v[0] = p.x(); v[1] = p.y(); v[2] = p.z(); }
+        operator vec3() const { return vec3(v[0], v[1], v[2]); }
+
+        float x() const { return v[0]; }
+        float y() const { return v[1]; }
+        float z() const { return v[2]; }
+
+    private:
+        float v[3];
+    };
+
+    class aabb
+    {
+    public:
+        aabb() {}
+        aabb( vec3_in center, vec3_in half_extent ) : center(center), half_extent(half_extent) {}
+        vec3 get_min() const { return center - half_extent; }
+        vec3 get_max() const { return center + half_extent; }
+        vec3 get_center() const { return center; }
+
+    private:
+        vec3 center, half_extent;
+    };
+
+    template <class T>
+    class dynarray
+    {
+    public:
+        void push_back( const T & t ) { data.push_back(t); }
+        void reset() { data.clear(); }
+        void resize( size_t n ) { data.resize(n); }
+        void reserve( size_t n ) { data.reserve(n); }
+        size_t size() const { return data.size(); }
+        T & operator[]( size_t i ) { return data[i]; }
+        const T & operator[]( size_t i ) const { return data[i]; }
+
+    private:
+        std::vector<T> data;
+    };
+
+    enum { atom_point };
+
+    class visitor
+    {
+    public:
+        template <class T> void visit( T &, int ) {}
+    };
+
+    enum
+    {
+        attribute_pos = 0
+    };
+
+    /// GL buffer in memory, writes[i] counts the writes to byte i since the last allocation
+    class gl_resource
+    {
+    public:
+        void allocate( size_t size )
+        {
+            bytes.assign(size, 0);
+            writes.assign(size, 0);
+        }
+
+        void assign( const void * src, size_t pos, size_t n )
+        {
+            if( pos + n > bytes.size() )
+            {
+                printf("gl_resource: write of [%d, %d) past the end of a buffer of %d bytes\n",
+                       (int)pos, (int)(pos + n), (int)bytes.size());
+                abort();
+            }
+            memcpy(&bytes[pos], src, n);
+            for( size_t i = pos; i < pos + n; i++ )
+                writes[i]++;
+        }
+
+        /// Write lock, the whole buffer is marked as written
+        class wolock
+        {
+        public:
+            wolock( gl_resource * res ) : res(res)
+            {
+                for( size_t i = 0; i < res->writes.size(); i++ )
+                    res->writes[i]++;
+            }
+            uint8_t * u8() { return res->bytes.empty() ? 0 : &res->bytes[0]; }
+
+        private:
+            gl_resource * res;
+        };
+
+        std::vector<uint8_t> bytes;
+        std::vector<unsigned> writes;
+    };
+
+    namespace scene
+    {
+        /// Mesh with its buffers in memory and its draw parameters recorded
+        class mesh
+        {
+        public:
+            virtual ~mesh() {}
+
+            void clear_attributes() {}
+            void set_default_attributes() {}
+            void add_attribute( unsigned attr, unsigned size, unsigned type, unsigned offset, unsigned norm = 0 ) {}
+
+            void set_params( unsigned stride, unsigned num_indices, unsigned num_vertices, unsigned mode, unsigned index_type )
+            {
+                this->stride = stride;
+                this->num_indices = num_indices;
+                this->num_vertices = num_vertices;
+                this->mode = mode;
+                this->index_type = index_type;
+            }
+
+            void set_num_vertices( unsigned n ) { num_vertices = n; }
+
+            void allocate( size_t vertex_size, size_t index_size )
+            {
+                vertices.allocate(vertex_size);
+                indices.allocate(index_size);
+            }
+
+            gl_resource * get_vertices() { return &vertices; }
+            gl_resource * get_indices() { return &indices; }
+
+            void set_aabb( const aabb & bb ) { box = bb; }
+            aabb get_aabb() const { return box; }
+
+            void visit( visitor & v ) {}
+
+            unsigned get_stride() const { return stride; }
+            unsigned get_num_indices() const { return num_indices; }
+            unsigned get_num_vertices() const { return num_vertices; }
+            unsigned get_mode() const { return mode; }
+            unsigned get_index_type() const { return index_type; }
+
+        private:
+            gl_resource vertices, indices;
+            aabb box;
+            unsigned stride = 0, num_indices = 0, num_vertices = 0, mode = 0, index_type = 0;
+        };
+    }
+
+    using namespace scene;
+}
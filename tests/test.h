@@ -0,0 +1,28 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Minimal checks for the CPU tests: CHECK prints the failed condition with its location and
+/// counts it, a test's main returns test_result() so make stops on the first failing test.
+
+#include <cstdio>
+
+static int test_failures = 0;
+static int test_checks = 0;
+
+#define CHECK( cond ) \
+    do \
+    { \
+        test_checks++; \
+        if( !(cond) ) \
+        { \
+            test_failures++; \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while( 0 )
+
+/// Prints a summary, returns the exit code of the test
+static int test_result( const char * name )
+{
+    printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+    return test_failures ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+// Chunked uploads (ChunkedUpload), and progressive uploads of QuickMesh, with a fake clock and GL buffers in memory.
+
+#include "headless_octet.h"
+using namespace octet;
+
+#include "test.h"
+#include "quick_mesh.h"
+
+/// Clock advanced by hand, in seconds
+static double fake_time = 0;
+
+static void test_schedule( size_t n, size_t chunk_size, double budget, double chunk_seconds )
+{
+    ChunkedUpload upload;
+    upload.chunk_size = chunk_size;
+    upload.clock = []() { return fake_time; };
+
+    // the fake sender takes chunk_seconds per chunk and counts how many times each item is sent
+    std::vector<int> sent(n, 0);
+    bool in_order = true;
+    size_t next = 0;
+    ChunkedUpload::Sender send = [&]( size_t first, size_t count ) {
+        in_order &= first == next && count > 0 && count <= chunk_size;
+        next = first + count;
+        for( size_t i = first; i < first + count && i < n; i++ )
+            sent[i]++;
+        fake_time += chunk_seconds;
+    };
+
+    upload.begin(n);
+    int steps = 0;
+    bool budget_kept = true, progress = true;
+    while( !upload.finished() && steps < 1000000 )
+    {
+        double start = fake_time;
+        size_t done = upload.done();
+        upload.step(budget, send);
+        steps++;
+        // a step stops once the budget is spent, so it overshoots by less than a chunk
+        double spent = fake_time - start;
+        if( budget > 0 )
+            budget_kept &= spent < budget + chunk_seconds;
+        // and always sends something
+        progress &= upload.done() > done;
+    }
+
+    CHECK(upload.finished());
+    CHECK(upload.done() == n);
+    CHECK(in_order);
+    CHECK(budget_kept);
+    CHECK(progress);
+    int bad = 0;
+    for( size_t i = 0; i < n; i++ )
+        bad += sent[i] != 1;
+    CHECK(bad == 0);
+
+    size_t chunks = (n + chunk_size - 1)/chunk_size;
+    if( budget <= 0 )
+        CHECK(steps <= 1);
+    else
+    {
+        // as many chunks per step as fit the budget
+        size_t per_step = std::max((size_t)ceil(budget/chunk_seconds), (size_t)1);
+        CHECK(steps == (int)((chunks + per_step - 1)/per_step));
+    }
+}
+
+/// Bytes [begin, end) of a buffer written once or more
+static bool written( const gl_resource & res, size_t begin, size_t end )
+{
+    for( size_t i = begin; i < end; i++ )
+    {
+        if( !res.writes[i] )
+            return false;
+    }
+    return true;
+}
+
+/// Adds runs of segments to a mesh: one path, or many short ones
+static void add_lines( QuickMesh & mesh, int paths, int segments )
+{
+    for( int p = 0; p < paths; p++ )
+    {
+        for( int i = 0; i < segments; i++ )
+        {
+            mesh.vertex(vec3(i*0.1f, p + (i & 1)*0.05f, 0));
+            mesh.vertex(vec3((i+1)*0.1f, p + ((i+1) & 1)*0.05f, 0));
+        }
+    }
+}
+
+/// Uploads a mesh over several frames, checking after each one that only sent data is drawn
+static void test_progressive( int format, int paths, int segments, bool share )
+{
+    QuickMesh mesh(GL_LINES);
+    mesh.share_vertices = share;
+    mesh.set_format(format);
+    add_lines(mesh, paths, segments);
+
+    // the same mesh sent at once, for reference
+    QuickMesh blocking(GL_LINES);
+    blocking.share_vertices = share;
+    blocking.set_format(format);
+    add_lines(blocking, paths, segments);
+    blocking.update();
+
+    // each call to the clock takes 1/1024 s, so a budget of 4/1024 s sends 4 chunks a frame
+    fake_time = 0;
+    mesh.upload.clock = []() { fake_time += 1.0/1024; return fake_time; };
+    mesh.upload.chunk_size = 100;
+    mesh.upload_budget = 4.0f/1024;
+    mesh.update();
+
+    const gl_resource & vertices = *mesh.get_vertices();
+    const gl_resource & indices = *mesh.get_indices();
+    size_t stride = VertexPacker::stride(format);
+    int frames = 1;
+    bool only_sent = true, growing = true;
+    size_t drawn = 0;
+    for( ;; )
+    {
+        // everything drawn has been sent
+        size_t n_vertices = mesh.get_num_vertices(), n_indices = mesh.get_num_indices();
+        only_sent &= written(vertices, 0, n_vertices*stride);
+        if( n_indices )
+        {
+            size_t index_bytes = mesh.get_index_type() == GL_UNSIGNED_SHORT ? 2 : 4;
+            only_sent &= written(indices, 0, n_indices*index_bytes);
+            for( size_t i = 0; i < n_indices; i++ )
+            {
+                const uint8_t * idx = &indices.bytes[0];
+                size_t j = index_bytes == 2 ? ((const uint16_t*)idx)[i] : ((const uint32_t*)idx)[i];
+                only_sent &= j < n_vertices;
+            }
+        }
+        // lines are drawn whole
+        if( mesh.get_mode() == GL_LINES )
+            only_sent &= (n_indices ? n_indices : n_vertices) % 2 == 0;
+
+        size_t now_drawn = n_indices ? n_indices : n_vertices;
+        growing &= now_drawn >= drawn;
+        drawn = now_drawn;
+
+        if( !mesh.continue_upload() )
+            break;
+        frames++;
+    }
+    CHECK(only_sent);
+    CHECK(growing);
+    CHECK(frames > 1);
+
+    // all of the buffers was sent once, and is drawn as with a blocking update
+    size_t n_vertices = mesh.get_num_vertices(), n_indices = mesh.get_num_indices();
+    CHECK(n_vertices == blocking.get_num_vertices());
+    CHECK(n_indices == blocking.get_num_indices());
+    CHECK(mesh.get_mode() == blocking.get_mode());
+    CHECK(mesh.get_index_type() == blocking.get_index_type());
+    int bad = 0;
+    for( size_t i = 0; i < n_vertices*stride; i++ )
+        bad += vertices.writes[i] != 1 || vertices.bytes[i] != blocking.get_vertices()->bytes[i];
+    size_t index_bytes = n_indices ? (mesh.get_index_type() == GL_UNSIGNED_SHORT ? 2 : 4) : 0;
+    for( size_t i = 0; i < n_indices*index_bytes; i++ )
+        bad += indices.writes[i] != 1 || indices.bytes[i] != blocking.get_indices()->bytes[i];
+    CHECK(bad == 0);
+}
+
+int main()
+{
+    // chunk times in powers of two, so the fake clock adds them up exactly
+    const double tick = 1.0/1024;
+    test_schedule(1000, 100, 4*tick, tick);
+    test_schedule(1001, 100, 3.5*tick, tick);
+    test_schedule(50, 100, 4*tick, tick);
+    test_schedule(12345, 64, 10*tick, 3*tick);
+    test_schedule(1000, 100, 0, tick);
+    test_schedule(0, 100, 4*tick, tick);
+
+    int formats[] = { VertexPacker::FORMAT_XY_FLOAT, VertexPacker::FORMAT_XY_INT16, VertexPacker::FORMAT_FULL };
+    for( int f = 0; f < 3; f++ )
+    {
+        // vertex pairs, a line strip, and indexed lines
+        test_progressive(formats[f], 300, 10, false);
+        test_progressive(formats[f], 1, 3000, true);
+        test_progressive(formats[f], 30, 100, true);
+    }
+    return test_result("chunked_upload");
+}
@@ -0,0 +1,213 @@
+// Shared points of connected lines (LineRuns), and the layouts QuickMesh draws them with, without GL.
+
+#include "headless_octet.h"
+using namespace octet;
+
+#include "test.h"
+#include "quick_mesh.h"
+
+typedef std::vector<vec3p> pair_list;
+
+/// Adds a path of n segments to pairs, as vertex pairs
+static void add_path( pair_list & pairs, float x, float y, size_t n )
+{
+    for( size_t i = 0; i < n; i++ )
+    {
+        pairs.push_back(vec3p(x + i, y + (i & 1), 0));
+        pairs.push_back(vec3p(x + i + 1, y + ((i+1) & 1), 0));
+    }
+}
+
+static bool same( const vec3p & a, const vec3p & b )
+{
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+static bool same( const pair_list & a, const pair_list & b )
+{
+    if( a.size() != b.size() )
+        return false;
+    for( size_t i = 0; i < a.size(); i++ )
+    {
+        if( !same(a[i], b[i]) )
+            return false;
+    }
+    return true;
+}
+
+/// Segments of runs, by expanding their indices
+static pair_list expand( const LineRuns & runs )
+{
+    pair_list res;
+    for( size_t i = 0; i < runs.indices.size(); i++ )
+        res.push_back(runs.points[runs.indices[i]]);
+    return res;
+}
+
+/// Point i of a buffer packed as x, y floats or as full vertices
+static vec3p packed_point( QuickMesh & mesh, size_t i )
+{
+    const float * p = (const float*)&mesh.get_vertices()->bytes[0] + i*mesh.get_stride()/sizeof(float);
+    return vec3p(p[0], p[1], mesh.get_format() == VertexPacker::FORMAT_FULL ? p[2] : 0);
+}
+
+/// Segments drawn by a mesh, as vertex pairs, whatever its layout
+static pair_list drawn_segments( QuickMesh & mesh )
+{
+    pair_list res;
+    if( mesh.get_mode() == GL_LINE_STRIP )
+    {
+        for( size_t i = 0; i + 1 < mesh.get_num_vertices(); i++ )
+        {
+            res.push_back(packed_point(mesh, i));
+            res.push_back(packed_point(mesh, i+1));
+        }
+    }
+    else if( mesh.get_num_indices() )
+    {
+        const uint8_t * idx = &mesh.get_indices()->bytes[0];
+        for( size_t i = 0; i < mesh.get_num_indices(); i++ )
+        {
+            size_t j = mesh.get_index_type() == GL_UNSIGNED_SHORT ? ((const uint16_t*)idx)[i] : ((const uint32_t*)idx)[i];
+            res.push_back(packed_point(mesh, j));
+        }
+    }
+    else
+    {
+        for( size_t i = 0; i < mesh.get_num_vertices(); i++ )
+            res.push_back(packed_point(mesh, i));
+    }
+    return res;
+}
+
+static void test_runs()
+{
+    // a single run shares all interior points
+    pair_list pairs;
+    add_path(pairs, 0, 0, 10);
+    LineRuns runs;
+    runs.add(&pairs[0], pairs.size());
+    CHECK(runs.runs == 1);
+    CHECK(runs.points.size() == 11);
+    CHECK(same(expand(runs), pairs));
+
+    // disjoint runs, and a segment on its own
+    add_path(pairs, 100, 0, 5);
+    add_path(pairs, 0, 100, 1);
+    add_path(pairs, 50, 50, 7);
+    runs.clear();
+    runs.add(&pairs[0], pairs.size());
+    CHECK(runs.runs == 4);
+    CHECK(runs.points.size() == 11 + 6 + 2 + 8);
+    CHECK(same(expand(runs), pairs));
+    CHECK(runs.index_bytes() == sizeof(uint16_t));
+
+    // appending pairs extends the runs without changing earlier ones
+    LineRuns appended;
+    appended.add(&pairs[0], 20);
+    appended.add(&pairs[0], 31);
+    appended.add(&pairs[0], pairs.size());
+    CHECK(appended.runs == runs.runs);
+    CHECK(appended.indices == runs.indices);
+    CHECK(same(expand(appended), pairs));
+
+    // 16 bit indices up to 65536 points, 32 bit past them
+    pairs.clear();
+    add_path(pairs, 0, 0, 65535);
+    runs.clear();
+    runs.add(&pairs[0], pairs.size());
+    CHECK(runs.points.size() == 65536);
+    CHECK(runs.index_bytes() == sizeof(uint16_t));
+    add_path(pairs, 0, 10, 1);
+    runs.add(&pairs[0], pairs.size());
+    CHECK(runs.points.size() == 65538);
+    CHECK(runs.index_bytes() == sizeof(uint32_t));
+    CHECK(same(expand(runs), pairs));
+
+    // indices are written with the size they need
+    std::vector<uint8_t> dst(runs.indices.size()*runs.index_bytes());
+    runs.write_indices(0, runs.indices.size(), &dst[0]);
+    CHECK(memcmp(&dst[0], &runs.indices[0], dst.size()) == 0);
+    runs.clear();
+    runs.add(&pairs[0], 8);
+    dst.resize(8*sizeof(uint16_t));
+    runs.write_indices(0, 8, &dst[0]);
+    int bad = 0;
+    for( int i = 0; i < 8; i++ )
+        bad += ((uint16_t*)&dst[0])[i] != runs.indices[i];
+    CHECK(bad == 0);
+}
+
+/// Draws pairs with a mesh, returns it updated
+static void draw( QuickMesh & mesh, int format, const pair_list & pairs )
+{
+    mesh.clear();
+    mesh.set_format(format);
+    for( size_t i = 0; i < pairs.size(); i++ )
+        mesh.vertex(pairs[i]);
+    mesh.update();
+}
+
+static void test_layouts()
+{
+    QuickMesh mesh(GL_LINES);
+
+    // a single run is a line strip over its points
+    pair_list pairs;
+    add_path(pairs, 0, 0, 100);
+    draw(mesh, VertexPacker::FORMAT_XY_FLOAT, pairs);
+    CHECK(mesh.get_mode() == GL_LINE_STRIP);
+    CHECK(mesh.get_num_vertices() == 101);
+    CHECK(mesh.get_num_indices() == 0);
+    CHECK(same(drawn_segments(mesh), pairs));
+
+    // long runs are indexed lines over shared points, with 16 bit indices
+    add_path(pairs, 0, 10, 100);
+    add_path(pairs, 0, 20, 100);
+    draw(mesh, VertexPacker::FORMAT_XY_FLOAT, pairs);
+    CHECK(mesh.get_mode() == GL_LINES);
+    CHECK(mesh.get_num_indices() == 600);
+    CHECK(mesh.get_num_vertices() == 303);
+    CHECK(mesh.get_index_type() == GL_UNSIGNED_SHORT);
+    CHECK(same(drawn_segments(mesh), pairs));
+
+    // segments on their own are drawn as pairs, indices would only add memory
+    pair_list single;
+    for( int i = 0; i < 100; i++ )
+        add_path(single, i*3.0f, 0, 1);
+    draw(mesh, VertexPacker::FORMAT_XY_FLOAT, single);
+    CHECK(mesh.get_mode() == GL_LINES);
+    CHECK(mesh.get_num_indices() == 0);
+    CHECK(mesh.get_num_vertices() == 200);
+    CHECK(same(drawn_segments(mesh), single));
+
+    // past 65536 points, indices are 32 bit. With floats they would cost as much as the duplicated
+    // points, so the layout only pays off for full vertices
+    pair_list large;
+    add_path(large, 0, 0, 40000);
+    add_path(large, 0, 10, 40000);
+    draw(mesh, VertexPacker::FORMAT_FULL, large);
+    CHECK(mesh.get_num_vertices() == 80002);
+    CHECK(mesh.get_index_type() == GL_UNSIGNED_INT);
+    CHECK(same(drawn_segments(mesh), large));
+    draw(mesh, VertexPacker::FORMAT_XY_FLOAT, large);
+    CHECK(mesh.get_num_indices() == 0);
+    CHECK(same(drawn_segments(mesh), large));
+
+    // appending to shared points, through update(first, n)
+    draw(mesh, VertexPacker::FORMAT_XY_FLOAT, pairs);
+    size_t first = pairs.size();
+    add_path(pairs, 200, 30, 50);
+    for( size_t i = first; i < pairs.size(); i++ )
+        mesh.vertex(pairs[i]);
+    mesh.update(first, pairs.size() - first);
+    CHECK(mesh.get_index_type() == GL_UNSIGNED_SHORT);
+    CHECK(same(drawn_segments(mesh), pairs));
+}
+
+int main()
+{
+    test_runs();
+    test_layouts();
+    return test_result("line_runs");
+}
@@ -0,0 +1,189 @@
+// Packing of points by VertexPacker, and range updates of a QuickMesh, without GL.
+
+#include "headless_octet.h"
+using namespace octet;
+
+#include "test.h"
+#include "quick_mesh.h"
+
+/// Position drawn for vertex i of a mesh's buffer, with the node offset and scale applied
+static vec3 drawn_vertex( QuickMesh & mesh, size_t i )
+{
+    const uint8_t * src = &mesh.get_vertices()->bytes[0];
+    vec3 offset = mesh.get_position_offset(), scale = mesh.get_position_scale();
+    if( mesh.get_format() == VertexPacker::FORMAT_XY_INT16 )
+    {
+        const int16_t * p = (const int16_t*)src + 2*i;
+        return vec3(offset.x() + p[0]*scale.x()/VertexPacker::INT16_MAX_VALUE,
+                    offset.y() + p[1]*scale.y()/VertexPacker::INT16_MAX_VALUE, 0);
+    }
+    const float * p = (const float*)src + 2*i;
+    return vec3(p[0], p[1], 0);
+}
+
+/// Largest error allowed for a quantized coordinate, half a step of the half extent plus rounding
+static float max_error( float half )
+{
+    return 0.5f*half/VertexPacker::INT16_MAX_VALUE*1.01f;
+}
+
+static void test_float_round_trip()
+{
+    VertexPacker packer(VertexPacker::FORMAT_XY_FLOAT);
+    std::vector<vec3p> src;
+    for( int i = 0; i < 100; i++ )
+        src.push_back(vec3p(i*0.37f - 13.0f, 1e6f/(i+1), 0));
+
+    std::vector<uint8_t> dst(src.size()*packer.stride());
+    packer.pack(&src[0], src.size(), &dst[0]);
+    CHECK(packer.stride() == 8);
+    for( size_t i = 0; i < src.size(); i++ )
+    {
+        vec3 p = packer.unpack(&dst[0], i);
+        CHECK(p.x() == src[i].x() && p.y() == src[i].y());
+    }
+    // floats hold any point
+    CHECK(packer.contains(vec3p(1e30f, -1e30f, 0)));
+}
+
+static void test_int16_round_trip()
+{
+    VertexPacker packer(VertexPacker::FORMAT_XY_INT16);
+    vec3 lo(-3.0f, 10.0f, 0), hi(5.0f, 10.5f, 0);
+    packer.set_bounds(lo, hi);
+    CHECK(packer.stride() == 4);
+
+    std::vector<vec3p> src;
+    for( int i = 0; i <= 1000; i++ )
+    {
+        float u = i/1000.0f;
+        src.push_back(vec3p(lo.x() + u*(hi.x() - lo.x()), hi.y() - u*u*(hi.y() - lo.y()), 0));
+    }
+
+    std::vector<uint8_t> dst(src.size()*packer.stride());
+    packer.pack(&src[0], src.size(), &dst[0]);
+    vec3 scale = packer.scale();
+    for( size_t i = 0; i < src.size(); i++ )
+    {
+        CHECK(packer.contains(src[i]));
+        vec3 p = packer.unpack(&dst[0], i);
+        CHECK(fabsf(p.x() - src[i].x()) <= max_error(scale.x()));
+        CHECK(fabsf(p.y() - src[i].y()) <= max_error(scale.y()));
+    }
+
+    // points outside the bounds, on each side
+    CHECK(!packer.contains(vec3p(hi.x() + 0.01f, 10.2f, 0)));
+    CHECK(!packer.contains(vec3p(lo.x() - 0.01f, 10.2f, 0)));
+    CHECK(!packer.contains(vec3p(0, hi.y() + 0.01f, 0)));
+    CHECK(!packer.contains(vec3p(0, lo.y() - 0.01f, 0)));
+
+    // a degenerate box still packs its points
+    packer.set_bounds(vec3(2, -1, 0), vec3(2, 4, 0));
+    vec3p vertical(2, 1.5f, 0);
+    CHECK(packer.contains(vertical));
+    uint8_t one[4];
+    packer.pack(&vertical, 1, one);
+    vec3 p = packer.unpack(one, 0);
+    CHECK(fabsf(p.x() - 2) <= 1e-5f && fabsf(p.y() - 1.5f) <= max_error(packer.scale().y()));
+}
+
+/// Adds a point to the mesh and to the points it should draw
+static void add( QuickMesh & mesh, std::vector<vec3> & expected, float x, float y )
+{
+    mesh.vertex(vec3(x, y, 0));
+    expected.push_back(vec3(x, y, 0));
+}
+
+/// Adds n segments along a parabola
+static void add_segments( QuickMesh & mesh, std::vector<vec3> & expected, size_t n )
+{
+    for( size_t i = 0; i < n; i++ )
+    {
+        float x = i*0.01f;
+        add(mesh, expected, x, x*x);
+        add(mesh, expected, x + 0.005f, -x);
+    }
+}
+
+/// Checks that the mesh draws all its points as pairs, each within the error of its format
+static void check_drawn( QuickMesh & mesh, const std::vector<vec3> & expected )
+{
+    CHECK(mesh.get_num_vertices() == expected.size());
+    CHECK(mesh.get_num_indices() == 0);
+    vec3 scale = mesh.get_position_scale();
+    bool quantized = mesh.get_format() == VertexPacker::FORMAT_XY_INT16;
+    float ex = quantized ? max_error(scale.x()) : 0, ey = quantized ? max_error(scale.y()) : 0;
+    int bad = 0;
+    for( size_t i = 0; i < expected.size(); i++ )
+    {
+        vec3 p = drawn_vertex(mesh, i);
+        bad += fabsf(p.x() - expected[i].x()) > ex || fabsf(p.y() - expected[i].y()) > ey;
+    }
+    CHECK(bad == 0);
+}
+
+/// Bytes of a buffer in [begin, end) written a given number of times
+static size_t count_writes( const gl_resource & res, size_t begin, size_t end, unsigned times )
+{
+    size_t n = 0;
+    for( size_t i = begin; i < end; i++ )
+        n += res.writes[i] == times;
+    return n;
+}
+
+static void test_range_update( int format )
+{
+    QuickMesh mesh(GL_LINES);
+    // vertex pairs, shared points are tested with the line runs
+    mesh.share_vertices = false;
+    mesh.set_format(format);
+    size_t stride = VertexPacker::stride(format);
+    const gl_resource & vertices = *mesh.get_vertices();
+
+    std::vector<vec3> expected;
+    add_segments(mesh, expected, 200);
+    mesh.update();
+    check_drawn(mesh, expected);
+    vec3 offset = mesh.get_position_offset(), scale = mesh.get_position_scale();
+
+    // points inside the buffer and the bounds: only the new ones are packed, with the same bounds
+    add(mesh, expected, 0.5f, 0.5f);
+    add(mesh, expected, 1.0f, -1.0f);
+    mesh.update(400, 2);
+    check_drawn(mesh, expected);
+    CHECK(count_writes(vertices, 0, 400*stride, 1) == 400*stride);
+    CHECK(count_writes(vertices, 400*stride, 402*stride, 1) == 2*stride);
+    CHECK(mesh.get_position_offset().x() == offset.x() && mesh.get_position_scale().y() == scale.y());
+
+    // a point outside the bounds repacks everything, relative to the new bounds when quantized
+    add(mesh, expected, 5.0f, 7.0f);
+    add(mesh, expected, -5.0f, -7.0f);
+    mesh.update(402, 2);
+    check_drawn(mesh, expected);
+    if( format == VertexPacker::FORMAT_XY_INT16 )
+    {
+        CHECK(mesh.get_position_scale().x() > scale.x() && mesh.get_position_scale().y() > scale.y());
+        CHECK(count_writes(vertices, 0, 402*stride, 2) == 402*stride);
+    }
+    else
+    {
+        // floats hold any point, so only the new points are packed
+        CHECK(count_writes(vertices, 0, 402*stride, 1) == 402*stride);
+    }
+
+    // growing past the buffer reallocates it and packs all points once
+    size_t first = expected.size();
+    add_segments(mesh, expected, 5000);
+    mesh.update(first, expected.size() - first);
+    check_drawn(mesh, expected);
+    CHECK(count_writes(vertices, 0, expected.size()*stride, 1) == expected.size()*stride);
+}
+
+int main()
+{
+    test_float_round_trip();
+    test_int16_round_trip();
+    test_range_update(VertexPacker::FORMAT_XY_FLOAT);
+    test_range_update(VertexPacker::FORMAT_XY_INT16);
+    return test_result("vertex_format");
+}
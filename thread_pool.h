@@ -0,0 +1,136 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+///////////////////////////////////////////////////////
+/// Minimal pool of persistent worker threads.
+/// parallel_for hands out task indices dynamically, the calling thread takes part in the work.
+class ThreadPool
+{
+public:
+    /// n_threads is the total number of threads used (including the caller), 0 uses all cores
+    ThreadPool( int n_threads = 0 )
+    {
+        if( n_threads <= 0 )
+            n_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+        for( int i = 0; i < n_threads-1; i++ )
+            workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for( int i = 0; i < workers.size(); i++ )
+            workers[i].join();
+    }
+
+    /// Total number of threads, including the caller
+    int size() const { return workers.size()+1; }
+
+    /// Calls fn(i) for each i in [0, n) and waits for completion
+    void parallel_for( int n, const std::function<void(int)> & fn )
+    {
+        if( n <= 0 )
+            return;
+
+        if( n == 1 || workers.empty() )
+        {
+            for( int i = 0; i < n; i++ )
+                fn(i);
+            return;
+        }
+
+        // one job at a time
+        std::unique_lock<std::mutex> job_lock(job_mutex);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job = &fn;
+            job_size = n;
+            next = 0;
+            pending = n;
+            generation++;
+        }
+        wake.notify_all();
+
+        run_tasks(&fn);
+
+        // wait for the tasks and for any worker still inside this job
+        std::unique_lock<std::mutex> lock(mutex);
+        while( pending > 0 || active > 0 )
+            done.wait(lock);
+        job = 0;
+    }
+
+    /// Pool shared by the application
+    static ThreadPool & shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    void run_tasks( const std::function<void(int)> * fn )
+    {
+        int n_done = 0;
+        for( int i = next++; i < job_size; i = next++ )
+        {
+            (*fn)(i);
+            n_done++;
+        }
+
+        if( n_done )
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pending -= n_done;
+        }
+    }
+
+    void worker_loop()
+    {
+        unsigned seen = 0;
+        while( true )
+        {
+            const std::function<void(int)> * fn = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while( !quit && (generation == seen || job == 0) )
+                    wake.wait(lock);
+                if( quit )
+                    return;
+                seen = generation;
+                fn = job;
+                active++;
+            }
+
+            run_tasks(fn);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            active--;
+            if( active == 0 && pending == 0 )
+                done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    std::mutex job_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int)> * job = 0;
+    int job_size = 0;
+    std::atomic<int> next;
+    int pending = 0;
+    int active = 0;
+    unsigned generation = 0;
+    bool quit = false;
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "float_param.h"
+
+///////////////////////////////////////////////////////
+/// Planar turtle, used by the renderers in place of a full transformation matrix.
+/// The state is a position and a unit heading vector, so moving is two multiply-adds
+/// and a stack entry is 20 bytes instead of a 64 byte matrix.
+/// With a fixed angle the heading is kept as an integer number of turns:
+/// - if the angle is a whole or tenth of a degree, heading directions are periodic and looked up in a table
+/// - otherwise the direction is computed from the number of turns, so no error accumulates
+/// With a randomized angle each turn draws an angle and rotates the heading vector.
+/// The turtle starts at the origin heading up (+y), positive turns are counter-clockwise.
+class Turtle2d
+{
+public:
+    struct State
+    {
+        float x, y;
+        float dx, dy;   // unit heading
+        int heading;    // net number of turns, or index in the direction table
+    };
+
+    /// Resets the turtle, for a given angle parameter and offset
+    void begin( const FloatParam & delta, float delta_offset )
+    {
+        this->delta = &delta;
+        this->delta_offset = delta_offset;
+        fixed = delta.values.size() < 2;
+        if( fixed )
+            set_angle((delta.values.size() ? delta.values[0] : 0.0f) + delta_offset);
+
+        stack.clear();
+        stack.push_back(origin());
+    }
+
+    /// State at the origin, heading up
+    State origin() const
+    {
+        State s = { 0, 0, 0, 1, 0 };
+        if( fixed )
+            set_heading(s, 0);
+        return s;
+    }
+
+    /// Composes a state relative to the origin with a base state,
+    /// giving the state reached from base by the commands that lead from the origin to local.
+    /// Only valid with a fixed angle.
+    State transform( const State & base, const State & local ) const
+    {
+        // rotation taking the up direction to the heading of base
+        State s;
+        s.x = base.x + local.x*base.dy + local.y*base.dx;
+        s.y = base.y - local.x*base.dx + local.y*base.dy;
+        set_heading(s, base.heading + local.heading);
+        return s;
+    }
+
+    /// True if each turn draws a different angle
+    bool randomized() const { return !fixed; }
+
+    /// Angle in degrees as meant by a float: values within rounding of a whole or tenth of a degree
+    /// (e.g. 25.7 or 86.9) are taken as exact
+    static double snap_angle( float angle )
+    {
+        for( int f = 1; f <= 10; f *= 10 )
+        {
+            double v = (double)angle*f;
+            double r = floor(v + 0.5);
+            if( fabs(v - r) <= 1e-4 )
+                return r/f;
+        }
+        return angle;
+    }
+
+    /// Number of distinct headings with a fixed angle that is a whole or tenth of a degree, 0 otherwise.
+    /// Headings are then indices in a table of directions, and a turn adds turn_step() to the index.
+    int turn_period() const { return period; }
+    int turn_step() const { return step; }
+    const std::pair<float, float> & direction( int h ) const { return directions[h]; }
+
+    /// n turns of a state, only valid with a fixed angle
+    void turn( State & s, int n ) const
+    {
+        set_heading(s, s.heading + n*step);
+    }
+
+    /// Moves forward by distance l
+    void move( float l )
+    {
+        State & s = top();
+        s.x += s.dx*l;
+        s.y += s.dy*l;
+    }
+
+    /// n turns, n > 0 for + and n < 0 for -
+    void rotate( int n )
+    {
+        State & s = top();
+        if( fixed )
+        {
+            turn(s, n);
+            return;
+        }
+
+        // randomized angle, each turn draws a value
+        int sign = n > 0 ? 1 : -1;
+        for( int i = 0; i < n*sign; i++ )
+        {
+            double a = radians(sign*(*delta + delta_offset));
+            float c = cos(a), sn = sin(a);
+            float dx = s.dx*c - s.dy*sn;
+            s.dy = s.dx*sn + s.dy*c;
+            s.dx = dx;
+        }
+    }
+
+    /// Moves to (x, y) relative to the current state (y forward, x to the right, as for transform()),
+    /// then turns n times. Only valid with a fixed angle
+    void jump( float x, float y, int n )
+    {
+        State local = { x, y, 0, 1, n*step };
+        top() = transform(top(), local);
+    }
+
+    void push()
+    {
+        stack.push_back(stack.back());
+    }
+
+    /// Returns false on stack underflow
+    bool pop()
+    {
+        if( stack.size() < 2 )
+            return false;
+        stack.pop_back();
+        return true;
+    }
+
+    vec3 pos() const { return vec3(top().x, top().y, 0); }
+
+    State & top() { return stack.back(); }
+    const State & top() const { return stack.back(); }
+
+    std::vector<State> stack;
+
+private:
+    enum
+    {
+        // finest angle resolution for the direction table, in turns per revolution
+        MAX_PERIOD = 3600
+    };
+
+    static double radians( double deg ) { return deg*(3.14159265358979323846/180.0); }
+
+    static int gcd( int a, int b )
+    {
+        while( b )
+        {
+            int t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    void set_angle( float angle )
+    {
+        this->angle = angle;
+        period = 0;
+        step = 1;
+        directions.clear();
+
+        // angle = 360*step/period, for whole and tenths of degrees
+        for( int q = 360; q <= MAX_PERIOD; q *= 10 )
+        {
+            double k = (double)angle*q/360.0;
+            int ik = (int)floor(k + 0.5);
+            if( fabs(k - ik) > 1e-4 )
+                continue;
+            if( ik == 0 )
+                break;
+            int g = gcd(abs(ik), q);
+            period = q/g;
+            step = ik/g;
+            break;
+        }
+
+        for( int i = 0; i < period; i++ )
+        {
+            double a = radians(90.0 + 360.0*i/period);
+            directions.push_back(std::make_pair((float)cos(a), (float)sin(a)));
+        }
+    }
+
+    void set_heading( State & s, int h ) const
+    {
+        if( period )
+        {
+            // turns mostly stay within a period of the last heading, avoiding a division
+            if( h >= period )
+                h -= period;
+            else if( h < 0 )
+                h += period;
+            if( h < 0 || h >= period )
+            {
+                h %= period;
+                if( h < 0 )
+                    h += period;
+            }
+            s.dx = directions[h].first;
+            s.dy = directions[h].second;
+        }
+        else
+        {
+            double a = radians(90.0 + (double)h*angle);
+            s.dx = cos(a);
+            s.dy = sin(a);
+        }
+        s.heading = h;
+    }
+
+    const FloatParam * delta = 0;
+    float delta_offset = 0;
+    bool fixed = true;
+
+    // fixed angle, and heading directions if periodic
+    float angle = 0;
+    int period = 0;
+    int step = 1;
+    std::vector< std::pair<float, float> > directions;
+};
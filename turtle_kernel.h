@@ -0,0 +1,151 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Interpretation of runs of turtle commands without brackets, with a fixed angle.
+/// Within such a run the heading only changes by whole turns, so each rotation is an
+/// integer update and a table lookup, each move two multiply-adds, and the vertex pairs
+/// of drawn segments are written straight to the output buffer.
+/// When headings are periodic and runs of F are merged, instructions are decoded through
+/// tables indexed by the instruction byte and the loop has no data dependent branches:
+/// command streams like those of Koch or Hilbert curves are irregular, and a branch per
+/// instruction would be mispredicted much of the time.
+class TurtleKernel
+{
+public:
+    /// Sets up the decoding tables for a turtle, with a segment length d
+    TurtleKernel( const Turtle2d & turtle, float d, bool merge_segments )
+    :
+    turtle(turtle),
+    d(d),
+    merge_segments(merge_segments)
+    {
+        int period = turtle.turn_period();
+        branchless = period > 0 && merge_segments;
+        for( int i = 0; i < 256; i++ )
+        {
+            int op = TurtleProgram::opcode(i);
+            int n = TurtleProgram::count(i);
+            drawn[i] = op == TurtleProgram::OP_F;
+            length[i] = (op == TurtleProgram::OP_F || op == TurtleProgram::OP_f) ? d*n : 0.0f;
+            turn[i] = 0;
+            if( period && (op == TurtleProgram::OP_PLUS || op == TurtleProgram::OP_MINUS) )
+            {
+                // turn in [0, period)
+                int t = ((op == TurtleProgram::OP_PLUS ? n : -n)*turtle.turn_step()) % period;
+                turn[i] = t < 0 ? t + period : t;
+            }
+        }
+    }
+
+    /// Interprets instructions [begin, end) of code, which must not contain brackets or extensions,
+    /// from state s of the turtle. Vertices are written to out if given, and their number returned.
+    size_t run( const uint8_t * code, size_t begin, size_t end, Turtle2d::State & s, vec3p * out ) const
+    {
+        if( branchless )
+            return run_branchless(code, begin, end, s, out);
+
+        size_t n_vertices = 0;
+        for( size_t i = begin; i < end; i++ )
+        {
+            int op = TurtleProgram::opcode(code[i]);
+            int n = TurtleProgram::count(code[i]);
+            while( i+1 < end && TurtleProgram::opcode(code[i+1]) == op )
+                n += TurtleProgram::count(code[++i]);
+
+            switch( op )
+            {
+                case TurtleProgram::OP_F:
+                {
+                    int segments = merge_segments ? 1 : n;
+                    float l = merge_segments ? d*n : d;
+                    for( int j = 0; j < segments; j++ )
+                    {
+                        if( out )
+                            *out++ = vec3(s.x, s.y, 0);
+                        s.x += s.dx*l;
+                        s.y += s.dy*l;
+                        if( out )
+                            *out++ = vec3(s.x, s.y, 0);
+                    }
+                    n_vertices += 2*segments;
+                    break;
+                }
+                case TurtleProgram::OP_f:
+                    s.x += s.dx*d*n;
+                    s.y += s.dy*d*n;
+                    break;
+                case TurtleProgram::OP_PLUS:
+                    turtle.turn(s, n);
+                    break;
+                case TurtleProgram::OP_MINUS:
+                    turtle.turn(s, -n);
+                    break;
+                default:
+                    break;
+            }
+        }
+        return n_vertices;
+    }
+
+private:
+    size_t run_branchless( const uint8_t * code, size_t begin, size_t end, Turtle2d::State & s, vec3p * out ) const
+    {
+        const int period = turtle.turn_period();
+        int h = s.heading;
+        float x = s.x, y = s.y;
+        float dx = s.dx, dy = s.dy;
+
+        // writes that don't start or end a segment go to a scratch vertex
+        vec3p scratch[1];
+        vec3p * o = out ? out : scratch;
+        const size_t advance = out ? 1 : 0;
+
+        size_t n_vertices = 0;
+        int prev_drawn = 0;
+        for( size_t i = begin; i < end; i++ )
+        {
+            uint8_t ins = code[i];
+            int cur_drawn = drawn[ins];
+            int next_drawn = i+1 < end ? drawn[code[i+1]] : 0;
+            // consecutive F instructions are one segment
+            int first = cur_drawn & !prev_drawn;
+            int last = cur_drawn & !next_drawn;
+
+            vec3p * p = first ? o : scratch;
+            *p = vec3(x, y, 0);
+            o += first*advance;
+
+            h += turn[ins];
+            h -= h >= period ? period : 0;
+            const std::pair<float, float> & dir = turtle.direction(h);
+            dx = dir.first;
+            dy = dir.second;
+            x += dx*length[ins];
+            y += dy*length[ins];
+
+            p = last ? o : scratch;
+            *p = vec3(x, y, 0);
+            o += last*advance;
+
+            n_vertices += first + last;
+            prev_drawn = cur_drawn;
+        }
+
+        s.heading = h;
+        s.x = x;
+        s.y = y;
+        s.dx = dx;
+        s.dy = dy;
+        return n_vertices;
+    }
+
+    const Turtle2d & turtle;
+    float d;
+    bool merge_segments;
+    bool branchless;
+
+    // decoding tables indexed by instruction
+    uint8_t drawn[256];
+    float length[256];
+    int turn[256];
+};
@@ -0,0 +1,298 @@
+#pragma once
+
+class LsystemRenderer;
+
+///////////////////////////////////////////////////////
+/// Derived l-system compiled to a packed stream of turtle commands.
+/// Each instruction is one byte: the opcode in the top 3 bits and either a repeat count (1-32)
+/// or, for extension symbols, an index into the extension table in the low 5 bits.
+class TurtleProgram
+{
+public:
+    enum
+    {
+        OP_F = 0,
+        OP_f,
+        OP_PLUS,
+        OP_MINUS,
+        OP_PUSH,
+        OP_POP,
+        OP_EXT,     // symbol handled by a registered function
+        OP_NONE     // symbol ignored by the turtle
+    };
+
+    enum
+    {
+        MAX_COUNT = 32,
+        MAX_EXTENSIONS = 32
+    };
+
+    typedef std::function<void(LsystemRenderer*)> Extension;
+
+    /// Alphabet entry of a builtin command: its symbol is compiled to the instruction op rather than
+    /// called through the extension table, fn being what the entry does when called directly
+    struct Builtin
+    {
+        int op;
+        Extension fn;
+        void operator()( LsystemRenderer * renderer ) const { fn(renderer); }
+    };
+
+    /// Decoded builtin command, runs of equal instructions are merged into one op
+    struct Op
+    {
+        uint8_t op;
+        int n;      // repeat count
+    };
+
+    enum
+    {
+        // ops passed to a renderer at once
+        BATCH_SIZE = 256
+    };
+
+    static uint8_t instruction( int op, int arg ) { return (op << 5) | arg; }
+    static int opcode( uint8_t ins ) { return ins >> 5; }
+    /// Repeat count of a builtin instruction
+    static int count( uint8_t ins ) { return (ins & 31) + 1; }
+    /// Extension index of an OP_EXT instruction
+    static int extension( uint8_t ins ) { return ins & 31; }
+
+    /// Sets up the symbol to instruction table from an alphabet. Builtin entries (see Builtin) are compiled
+    /// to their instruction, other entries are extension symbols called through their function,
+    /// and symbols not in the alphabet are ignored
+    void set_alphabet( const std::map<char, Extension> & alphabet )
+    {
+        for( int i = 0; i < 256; i++ )
+            symbols[i] = instruction(OP_NONE, 0);
+
+        extensions.clear();
+        for( std::map<char, Extension>::const_iterator it = alphabet.begin(); it != alphabet.end(); ++it )
+        {
+            uint8_t & ins = symbols[(unsigned char)it->first];
+            const Builtin * builtin = it->second.target<Builtin>();
+            if( builtin )
+            {
+                ins = instruction(builtin->op, 0);
+                continue;
+            }
+            if( extensions.size() == MAX_EXTENSIONS )
+            {
+                printf("Too many extension symbols, ignoring %c\n", it->first);
+                continue;
+            }
+            ins = instruction(OP_EXT, extensions.size());
+            extensions.push_back(it->second);
+        }
+    }
+
+    /// The builtin turtle symbols F, f, +, -, [ and ], for programs that are only compiled and run
+    static std::map<char, Extension> builtin_alphabet()
+    {
+        std::map<char, Extension> alphabet;
+        const char symbols[] = "Ff+-[]";
+        for( int op = OP_F; op <= OP_POP; op++ )
+        {
+            Builtin b = { op, Extension() };
+            alphabet[symbols[op]] = b;
+        }
+        return alphabet;
+    }
+
+    void clear()
+    {
+        code.clear();
+        revision = next_revision();
+    }
+
+    /// Compiles a derived string, consecutive equal builtin commands are run length encoded
+    void compile( const char * str, size_t n )
+    {
+        clear();
+        for( size_t i = 0; i < n; i++ )
+        {
+            uint8_t ins = symbols[(unsigned char)str[i]];
+            int op = opcode(ins);
+            if( op == OP_NONE )
+                continue;
+
+            if( op < OP_EXT && !code.empty() )
+            {
+                uint8_t & last = code.back();
+                if( opcode(last) == op && count(last) < MAX_COUNT )
+                {
+                    last++;
+                    continue;
+                }
+            }
+            code.push_back(ins);
+        }
+    }
+
+    /// Executes a single instruction with a renderer
+    template <class Renderer>
+    void execute( uint8_t ins, Renderer * renderer ) const
+    {
+        int n = count(ins);
+        switch( opcode(ins) )
+        {
+            case OP_F:
+                for( int i = 0; i < n; i++ )
+                    renderer->F();
+                break;
+            case OP_f:
+                for( int i = 0; i < n; i++ )
+                    renderer->f();
+                break;
+            case OP_PLUS:
+                for( int i = 0; i < n; i++ )
+                    renderer->plus();
+                break;
+            case OP_MINUS:
+                for( int i = 0; i < n; i++ )
+                    renderer->minus();
+                break;
+            case OP_PUSH:
+                for( int i = 0; i < n; i++ )
+                    renderer->push();
+                break;
+            case OP_POP:
+                for( int i = 0; i < n; i++ )
+                    renderer->pop();
+                break;
+            case OP_EXT:
+                extensions[extension(ins)](renderer);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /// Executes a single symbol with a renderer
+    template <class Renderer>
+    void execute_symbol( char a, Renderer * renderer ) const
+    {
+        uint8_t ins = symbols[(unsigned char)a];
+        if( opcode(ins) != OP_NONE )
+            execute(ins, renderer);
+    }
+
+    /// Passes a batch of ops to the run interface of a renderer (F_run, f_run, rotate, push, pop).
+    /// With the renderer's final type the calls are resolved statically.
+    template <class Renderer>
+    static void dispatch( const Op * ops, size_t n_ops, Renderer * renderer )
+    {
+        for( size_t i = 0; i < n_ops; i++ )
+        {
+            int n = ops[i].n;
+            switch( ops[i].op )
+            {
+                case OP_F:
+                    renderer->F_run(n);
+                    break;
+                case OP_f:
+                    renderer->f_run(n);
+                    break;
+                case OP_PLUS:
+                    renderer->rotate(n);
+                    break;
+                case OP_MINUS:
+                    renderer->rotate(-n);
+                    break;
+                case OP_PUSH:
+                    for( int j = 0; j < n; j++ )
+                        renderer->push();
+                    break;
+                case OP_POP:
+                    for( int j = 0; j < n; j++ )
+                        renderer->pop();
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    /// Collects instructions into ops, merging runs, and passes them to the consume() method
+    /// of a renderer in batches. Extension symbols are called directly, after the ops before them.
+    /// flush() must be called after the last instruction.
+    template <class Renderer>
+    class Batch
+    {
+    public:
+        Batch( const TurtleProgram & program, Renderer * renderer )
+        :
+        program(program),
+        renderer(renderer)
+        {
+        }
+
+        void add( uint8_t ins )
+        {
+            int op = opcode(ins);
+            if( op == OP_NONE )
+                return;
+            if( op == OP_EXT )
+            {
+                flush();
+                program.extensions[extension(ins)](renderer);
+                return;
+            }
+
+            if( n_ops && ops[n_ops-1].op == op )
+            {
+                ops[n_ops-1].n += count(ins);
+                return;
+            }
+            // the last op is complete once a different one follows, so runs are never split
+            if( n_ops == BATCH_SIZE )
+                flush();
+            Op o = { (uint8_t)op, count(ins) };
+            ops[n_ops++] = o;
+        }
+
+        void symbol( char a )
+        {
+            add(program.symbols[(unsigned char)a]);
+        }
+
+        void flush()
+        {
+            if( n_ops )
+                renderer->consume(ops, n_ops);
+            n_ops = 0;
+        }
+
+    private:
+        const TurtleProgram & program;
+        Renderer * renderer;
+        Op ops[BATCH_SIZE];
+        size_t n_ops = 0;
+    };
+
+    /// Executes the whole program with a renderer.
+    /// Consecutive instructions of the same command are passed to the renderer as one run, in batches.
+    template <class Renderer>
+    void run( Renderer * renderer ) const
+    {
+        Batch<Renderer> batch(*this, renderer);
+        size_t n_code = code.size();
+        for( size_t i = 0; i < n_code; i++ )
+            batch.add(code[i]);
+        batch.flush();
+    }
+
+    std::vector<uint8_t> code;
+    std::vector<Extension> extensions;
+    uint8_t symbols[256];
+    
+    // changes whenever the program is rebuilt, unique across programs
+    unsigned revision = next_revision();
+    
+private:
+    static unsigned next_revision()
+    {
+        static unsigned counter = 0;
+        return ++counter;
+    }
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+///////////////////////////////////////////////////////
+/// Packing of line vertices into the layout uploaded to the GPU.
+/// Line art is planar and has no normals or texture coordinates, so besides the full octet
+/// vertex (position, normal and uv, 32 bytes) points can be packed as:
+/// - FORMAT_XY_FLOAT: x, y as floats (8 bytes)
+/// - FORMAT_XY_INT16: x, y as normalized shorts relative to a box (4 bytes), the box center
+///   and half extent must then be applied as a translation and scale of the mesh node
+/// Packing only writes to memory, it doesn't need a GL context.
+class VertexPacker
+{
+public:
+    enum
+    {
+        FORMAT_FULL = 0,
+        FORMAT_XY_FLOAT,
+        FORMAT_XY_INT16
+    };
+
+    enum
+    {
+        INT16_MAX_VALUE = 32767
+    };
+
+    VertexPacker( int format = FORMAT_XY_FLOAT )
+    :
+    format(format)
+    {
+    }
+
+    /// Bytes per packed vertex
+    static size_t stride( int format )
+    {
+        switch( format )
+        {
+            case FORMAT_XY_FLOAT:
+                return 2*sizeof(float);
+            case FORMAT_XY_INT16:
+                return 2*sizeof(int16_t);
+            default:
+                return 8*sizeof(float);
+        }
+    }
+
+    size_t stride() const { return stride(format); }
+
+    /// True if positions are quantized, and need set_bounds() before packing
+    bool quantized() const { return format == FORMAT_XY_INT16; }
+
+    /// Sets the box quantized positions are relative to
+    void set_bounds( const vec3 & min, const vec3 & max )
+    {
+        for( int i = 0; i < 2; i++ )
+        {
+            center[i] = 0.5f*(min[i] + max[i]);
+            // degenerate boxes (e.g. a single vertical line) still map to a valid range
+            half[i] = std::max(0.5f*(max[i] - min[i]), 1e-6f);
+            // a slightly larger box, so rounding of the bounds themselves stays in range
+            half[i] *= 1.0f + 1e-5f;
+        }
+    }
+
+    /// True if a point can be packed with the current bounds
+    bool contains( const vec3p & p ) const
+    {
+        if( !quantized() )
+            return true;
+        return fabs(p.x() - center[0]) <= half[0] && fabs(p.y() - center[1]) <= half[1];
+    }
+
+    /// Translation and scale that take packed positions back to the original ones
+    vec3 offset() const { return quantized() ? vec3(center[0], center[1], 0) : vec3(0, 0, 0); }
+    vec3 scale() const { return quantized() ? vec3(half[0], half[1], 1) : vec3(1, 1, 1); }
+
+    /// Packs n points to dst, which must hold n*stride() bytes
+    void pack( const vec3p * src, size_t n, uint8_t * dst ) const
+    {
+        switch( format )
+        {
+            case FORMAT_XY_FLOAT:
+            {
+                float * out = (float*)dst;
+                for( size_t i = 0; i < n; i++ )
+                {
+                    out[2*i] = src[i].x();
+                    out[2*i+1] = src[i].y();
+                }
+                break;
+            }
+            case FORMAT_XY_INT16:
+            {
+                int16_t * out = (int16_t*)dst;
+                float sx = INT16_MAX_VALUE/half[0], sy = INT16_MAX_VALUE/half[1];
+                for( size_t i = 0; i < n; i++ )
+                {
+                    out[2*i] = quantize((src[i].x() - center[0])*sx);
+                    out[2*i+1] = quantize((src[i].y() - center[1])*sy);
+                }
+                break;
+            }
+            default:
+            {
+                float * out = (float*)dst;
+                for( size_t i = 0; i < n; i++, out += 8 )
+                {
+                    out[0] = src[i].x(); out[1] = src[i].y(); out[2] = src[i].z();
+                    out[3] = 0; out[4] = 0; out[5] = 1;
+                    out[6] = 0; out[7] = 0;
+                }
+                break;
+            }
+        }
+    }
+
+    /// Position of the i-th packed vertex in src, as it will be drawn
+    vec3 unpack( const uint8_t * src, size_t i ) const
+    {
+        switch( format )
+        {
+            case FORMAT_XY_FLOAT:
+            {
+                const float * p = (const float*)src + 2*i;
+                return vec3(p[0], p[1], 0);
+            }
+            case FORMAT_XY_INT16:
+            {
+                const int16_t * p = (const int16_t*)src + 2*i;
+                return vec3(center[0] + p[0]*(half[0]/INT16_MAX_VALUE),
+                            center[1] + p[1]*(half[1]/INT16_MAX_VALUE), 0);
+            }
+            default:
+            {
+                const float * p = (const float*)src + 8*i;
+                return vec3(p[0], p[1], p[2]);
+            }
+        }
+    }
+
+    int format;
+
+private:
+    static int16_t quantize( float v )
+    {
+        v = std::min(std::max(v, (float)-INT16_MAX_VALUE), (float)INT16_MAX_VALUE);
+        return (int16_t)lrintf(v);
+    }
+
+    float center[2] = { 0, 0 };
+    float half[2] = { 1, 1 };
+};